@@ -18,109 +18,343 @@
  */
 
 // INCLUDES
-#include <avr/io.h>         // standard input/output for handy macros
-#include <util/delay.h>     // for delay functions
-#include <avr/power.h>      // handy power down commands
-#include <avr/wdt.h>        // easy control of the watchdog (wakes the device)
-#include <avr/sleep.h>      // sleep mode for lower power consumption
-#include <avr/interrupt.h>  // for sei()
+#include "hal.h"            // registers, delays, sleep modes and interrupts
 #include "To-mate-Oh.h"
 
 int main(void) {
-    unsigned i;
+    unsigned i, n;
 
     // SETUP
-    state = WORK;         // When not idling go to work
-    cal = Get_cal();      // Calibrate the touch button
+    state = IDLE;         // Wait for the first touch
+#if TELEMETRY
+    DDRB  |= (1 << DDB0); // The telemetry line idles low, the buzzer is off
+#endif
+#if DEEP_SLEEP
+    ACSR = (1 << ACD);    // Analog comparator off, it is never used
+    DIDR0 = DIDR_AWAKE;   // No input buffers on pins that are only driven
+#endif
+    Cal_wdt();            // Measure the watchdog period against the CPU clock
+    Get_vcc();            // and the supply voltage, to scale the LEDs to it
+#if AMBIENT
+    Get_light();          // and to the ambient light
+#endif
+    if( Load_cal() ) n = LED_N;   // Cached calibration still fits the button
+    else {
+      n = cal = Get_cal();        // Calibrate the touch button
+#if SENSE_ADC
+      n -= btn_base >> 8;         // show the threshold, the baseline is over
+#endif                            // 100 (cal is never below it)
+    }
+#if TELEMETRY
+    Tlm_send(TLM_CAL, cal, btn_var);
+#endif
 
     // INDICATE READINESS (and led/buzzer function & calibration value)
-    for(i=0; i<cal; ++i) {
-      Shine_led(i%6, 10);   _delay_ms(10);
+    for(i=0; i<n; ++i) {
+      Shine_led(i%6, MS2FRAME(100));   _delay_ms(10);
       if( i>5 && Get_time()>cal ) break;
     }
+#if BUZZ_TUNE
+    if( Get_time()>cal ) {  // Touched as the LEDs circle: tune the buzzer if
+      btn_held = 1;         // it is held on
+      Tune_buzz();
+    }
+#endif
 
     // MAIN LOOP
+    Clock_set(CLK_SLOW);  // Full speed is only needed for sensing from now on
+    Enter(IDLE);
     while( 1 ) {
-      if( Get_time()>cal ) Handle_button_press();
-      Sleep_now(1, WDTO_500MS);
+      Run_events();
+      Led_update();
+      Sleep_now(1, Next_timeout());
     }
 
     return 0;
 }
 
-//###################################################################### Timing
+//################################################################## Scheduler
 
-void Handle_button_press() {
-    int i, j;
-    unsigned char k;
-    uint32_t t_led;
-    unsigned char tmp;
-    unsigned char leds;
-    uint16_t bright=T_ON;
-    uint16_t on_iter;
-
-    if(state==WORK) {
-        tmp = 0; leds = 5; // Initially all five LEDs on
-        // Cycle through the leds
-        for( i=0; i<25; ++i) { // 25 iterations, each one minute
-          j = i%5;
-          if( j==0 ) {
-            leds--;   // turn off one led every 5 minutes
-            bright = T_ON-10;
-          }
-          bright>>=1; // reduce brightness of leading led every minute
-
-          for( t_led=0; t_led<(uint32_t)6e7/T_CYC; ++t_led) {
-
-            // Blink led to indicate time in the fifth of a pomodoro
-            if( j>0 && t_led%((uint32_t)5e5/T_CYC)==0 ) {
-              if(tmp == 0) { --leds; tmp=1; }
-              else { ++leds; --j; tmp=0; }
-            }
-
-            // PWM the leds
-            for( k=0; k<6; ++k ) {
-              Set_leds(leds-k);
-              if( k==0 ) {
-                for(on_iter=0; on_iter<bright; ++on_iter)
-                  _delay_us(1);
-                Set_leds(-1);
-                for(on_iter=0; on_iter<T_ON-bright-10; ++on_iter) _delay_us(1);
-              } else {
-                _delay_us(T_ON);
-                Set_leds(-1);
-              }
-              _delay_us( (T_OFF-T_ON*5)/6-150 );
-            }
-
-            // Check for user abort
-            if( t_led>(uint32_t)1e6/T_CYC && Get_time()>cal ) {
-              state = REST; i=25; break;
-            }
-          }
-        }
-        if( state != REST ) { state = WAIT; Play_sound(); }
+uint16_t Uptime() {
+    uint16_t t;
+    cli(); t = uptime; sei();
+    return t;
+}
+
+void Schedule(uint8_t ev, uint16_t delay) {
+    ev_at[ev] = Uptime() + delay;
+    ev_armed |= (1 << ev);
+}
+
+void Repeat(uint8_t ev, uint16_t period) {
+    ev_at[ev] += period;  // relative to the last due time, so it does not drift
+    ev_armed |= (1 << ev);
+}
+
+void Run_events() {
+    uint8_t ev = 0;
+
+    while( ev<EV_N ) {
+      if( !(ev_armed & (1 << ev)) || (int16_t)(Uptime()-ev_at[ev])<0 ) {
+        ++ev;
+        continue;
+      }
+      ev_armed &= ~(1 << ev);
+      switch( ev ) {
+        case EV_SCAN:   On_scan();   break;
+        case EV_MINUTE: On_minute(); break;
+        case EV_BLINK:  On_blink();  break;
+        case EV_SOUND:  On_seq(SEQ_SOUND); break;
+        case EV_FADE:   On_fade();   break;
+#if GLANCE
+        case EV_GLANCE: On_glance(); break;
+#endif
+      }
+      ev = 0;               // handlers may have queued events that are due
     }
+}
 
-    if(state==WAIT) {
-        // Blink red led until button is pressed or go to idle if timed out
-        for(t_led=0; t_led<300; t_led++) {
-          Shine_led(5, 49);  Sleep_now(1, WDTO_500MS);
-          if( t_led>5 && Get_time()>cal ) { state = REST; break; }
-        }
-        if(state != REST) { state=WORK; return; }
+uint8_t Next_timeout() {
+    uint8_t ev, p;
+    int16_t dt = 1 << WDTO_2S, left;
+
+    for( ev=0; ev<EV_N; ++ev ) {
+      if( !(ev_armed & (1 << ev)) ) continue;
+      left = ev_at[ev]-Uptime();
+      if( left<dt ) dt = left;
     }
+    for( p=WDTO_2S; p>WDTO_15MS && (1 << p)>dt; --p );
+    return p;
+}
+
+//############################################################### State machine
+
+static const uint8_t seq_melody[] PROGMEM = {  // indicator melody
+    SEQ(0, BRIGHT_MAX, 1, 700), SEQ(0, 0, 0, 50), SEQ(0, BRIGHT_MAX, 1, 350),
+    SEQ(0, 0, 0, 50), SEQ(0, BRIGHT_MAX, 1, 350), SEQ(0, 0, 0, 50),
+    SEQ(0, BRIGHT_MAX, 1, 700), SEQ(0, 0, 0, 50), SEQ(0, BRIGHT_MAX, 1, 350),
+    SEQ(0, 0, 0, 50), SEQ(0, BRIGHT_MAX, 1, 350), SEQ(0, 0, 0, 50),
+    SEQ(0, BRIGHT_MAX, 1, 700), SEQ(0, 0, 0, 50), SEQ(0, BRIGHT_MAX, 1, 350),
+    SEQ(0, 0, 0, 50), SEQ(0, BRIGHT_MAX, 1, 350), SEQ(0, 0, 0, 50),
+    SEQ(0, BRIGHT_MAX, 1, 700), SEQ(0, 0, 0, 50), SEQ(0, BRIGHT_MAX, 1, 350),
+    SEQ_END
+};
+static const uint8_t seq_wait[] PROGMEM = {    // WAIT: red led blinks
+    SEQ(5, BRIGHT_MAX, 0, 490), SEQ(5, 0, 0, 500), SEQ_LOOP(2)
+};
+static const uint8_t seq_lowbat[] PROGMEM = {  // battery low: red flickers
+    SEQ(5, BRIGHT_MAX, 0, 100), SEQ(5, 0, 0, 100), SEQ(5, BRIGHT_MAX, 0, 100),
+    SEQ(5, 0, 0, 100), SEQ(5, BRIGHT_MAX, 0, 100), SEQ_END
+};
+
+static uint8_t minutes;     // minutes spent in the current state
+static uint8_t fifth;       // minute within the fifth of a pomodoro (WORK)
+static uint8_t recal_in;    // minutes until the watchdog is calibrated again
+static uint8_t vcc_in;      // minutes until the supply is measured again
+#if AMBIENT
+static uint8_t amb_in;      // minutes until the light is measured again
+#endif
+static signed char leds;    // leading LED of the WORK display
+static uint8_t bright;      // brightness level of the leading LED
+static uint8_t blinks;      // blink phases left (WORK) or LED on (WAIT)
+static uint8_t scan_gap;    // ticks until the next scan of the button
+static uint8_t scan_quiet;  // quiet scans at the current scan_gap
+static uint16_t scan_last;  // since when a touch would have been seen
+#if GLANCE
+static uint8_t glance_show; // WORK display is looked at after a touch
+static uint8_t glance_ph;   // phases left of a progress flash
+#endif
 
-    if(state==REST) {
-        for(t_led=0; t_led<300; ++t_led) {
-          Shine_led(5, 100);
-          if( t_led%60==59 ) Sleep_now(1, WDTO_500MS);
-          if( Get_time()>cal ) { state=WORK; return; };
+void Enter(uint8_t s) {
+#if COUNTERS
+    if( s==WAIT ) ++ctr.done;
+    else if( s==REST && state==WORK ) ++ctr.aborted;
+    if( s==IDLE && state!=IDLE ) Save_ctr();
+#endif
+    if( s==IDLE && state!=IDLE ) Save_cal();  // a session is over
+    state = s;
+#if TELEMETRY
+    Tlm_send(TLM_STATE, s, uptime);
+#endif
+    minutes = 0;
+    fifth = 0;
+    recal_in = WDT_RECAL;
+    vcc_in = VCC_CHECK;
+#if AMBIENT
+    amb_in = AMB_CHECK;
+#endif
+    blinks = 0;
+    ev_armed &= (1 << EV_SOUND);  // a melody may outlast the state
+    Led_clear();
+    switch( s ) {
+      case WORK:                // the melody's LED belongs to the display now
+        if( ev_armed & (1 << EV_SOUND) ) Seq_end(SEQ_SOUND);
+        Cal_wdt();
+        if( Get_vcc()<VCC_LOW ) Seq_play(SEQ_SOUND, seq_lowbat);
+#if AMBIENT
+        Get_light();
+#endif
+        leds = 5;
+#if GLANCE
+        Glance_show();          // the progress shows when a pomodoro starts
+#endif
+        Schedule(EV_MINUTE, 0);
+        Scan_after(MS2TICK(1000));
+        break;
+      case WAIT:
+        Seq_play(SEQ_ANIM, seq_wait);
+        Schedule(EV_MINUTE, MINUTE);
+        Scan_after(MS2TICK(5000));
+        break;
+      case REST:
+        Led_level(5, BRIGHT_MAX);
+        Schedule(EV_MINUTE, MINUTE);
+        Scan_after(MS2TICK(1000));
+        break;
+      default:
+        Scan_after(SCAN_FAST);
+        break;
+    }
+}
+
+void Scan_after(uint16_t guard) {
+    scan_gap = SCAN_FAST;   // there was activity, stay attentive for a while
+    scan_quiet = 0;
+    scan_last = Uptime() + guard;
+    Schedule(EV_SCAN, guard);
+}
+
+void On_touch() {
+    switch( state ) {
+      case IDLE: Enter(WORK); break;  // start a pomodoro
+      case WORK:                      // abort it and rest
+#if GLANCE
+        if( !glance_show ) {          // or just look first
+          Glance_show();
+          Scan_after(SCAN_FAST);
+          break;
         }
-        state = WORK;
+#endif
+        // fall through
+      case WAIT: Enter(REST); break;  // start the rest period
+      default:   Enter(IDLE); break;  // turn the timer off
     }
+}
 
-    Play_sound();
+void On_scan() {
+    uint8_t b = Scan_button();
+
+#if SCAN_STATS
+    ++scan_n[state];
+#endif
+#if COUNTERS
+    ++ctr.scans;
+    if( b==BTN_PRESS ) ++ctr.touches;
+    if( (ctr.wakes | ctr.scans | ctr.awake) & 0x8000 ) Save_ctr();
+#endif
+    if( b==BTN_PRESS ) {
+#if SCAN_STATS
+      // the touch started somewhere since the last scan, count the worst case
+      scan_lat[state] += Uptime()-scan_last;
+      ++scan_hits[state];
+#endif
+      On_touch();
+      return;
+    }
+    if( b==BTN_NEAR ) {     // something is going on, scan fast
+      scan_gap = SCAN_FAST;
+      scan_quiet = 0;
+    } else if( ++scan_quiet>=SCAN_BACKOFF &&
+               scan_gap<(state==IDLE ? SCAN_SLOW : SCAN_BUSY) ) {
+      scan_gap <<= 1;       // quiet for a while, back off
+      scan_quiet = 0;
+    }
+    scan_last = Uptime();
+    Schedule(EV_SCAN, scan_gap);
+}
+
+void On_minute() {
+    uint8_t j;
+
+    ++minutes;
+    if( !--recal_in ) { recal_in = WDT_RECAL; Cal_wdt(); }
+    if( !--vcc_in ) { vcc_in = VCC_CHECK; Get_vcc(); }
+#if AMBIENT
+    if( !--amb_in ) { amb_in = AMB_CHECK; Get_light(); }
+#endif
+    if( state==WORK ) {
+      if( minutes>WORK_MIN ) { Enter(WAIT); Play_sound(); return; }
+      j = fifth;                // (minutes-1)%5, counted instead of divided
+      if( ++fifth==5 ) fifth = 0;
+      if( j==0 ) {
+        leds--;   // turn off one led every 5 minutes
+        bright = BRIGHT_MAX;    // the leading one fades out over 5 minutes
+        Schedule(EV_FADE, FADE_STEP);
+      }
+      blinks = 2*j;             // blink the minutes passed in this fifth
+      Show_work(leds);
+      if( blinks ) Schedule(EV_BLINK, 0);
+      Repeat(EV_MINUTE, MINUTE);
+    } else if( minutes>=(state==REST ? REST_MIN : WAIT_MIN) ) {
+      if( state==REST ) Play_sound();
+      Enter(IDLE);
+    } else Repeat(EV_MINUTE, MINUTE);
+}
+
+void On_blink() {
+    if( state==WORK ) {         // leading led off on odd, on on even phases
+      --blinks;
+      Show_work(blinks&1 ? leds-1 : leds);
+      if( blinks ) Repeat(EV_BLINK, MS2TICK(500));
+    } else On_seq(SEQ_ANIM);    // animation of the state
+}
+
+void On_fade() {
+    if( state!=WORK ) return;
+    --bright;
+    Show_work(blinks&1 ? leds-1 : leds);
+    if( bright>1 ) Repeat(EV_FADE, FADE_STEP);
+}
+
+void Show_work(signed char lead) {
+    unsigned char k;
+
+#if GLANCE
+    if( !glance_show ) return;  // dark, or a flash owns the LEDs
+#endif
+    for( k=0; k<5; ++k )
+      Led_level(k, (signed char)k<lead ? BRIGHT_MAX :
+                   (signed char)k==lead ? bright : 0);
+}
+
+#if GLANCE
+void Glance_show() {
+    glance_show = 1;
+    glance_ph = 0;
+    Show_work(blinks&1 ? leds-1 : leds);
+    Schedule(EV_GLANCE, MS2TICK(GLANCE_SHOW*1000UL));
+}
+
+void On_glance() {
+    uint8_t j = fifth ? fifth-1 : 4;    // minutes passed in the slice
+
+    if( state!=WORK ) return;
+    Led_clear();
+    if( glance_show ) glance_show = 0;  // the look after a touch is over
+    else if( !glance_ph ) {             // flash the slices left
+      glance_show = 1;
+      Show_work(leds);
+      glance_show = 0;
+      glance_ph = 2*j+1;
+    } else if( --glance_ph & 1 )        // then blink the minutes passed
+      Led_level(leds, BRIGHT_MAX);
+    if( glance_ph ) Schedule(EV_GLANCE, MS2TICK(GLANCE_MS));
+    else Schedule(EV_GLANCE, MS2TICK(GLANCE_EVERY*1000UL));
+}
+#endif
+
+void Play_sound() {
+    Seq_play(SEQ_SOUND, seq_melody);
 }
 
 //=============================================================================
@@ -129,101 +363,492 @@ void Handle_button_press() {
 
 //###################################################################Sleep mode
 
-EMPTY_INTERRUPT(WDT_vect);
+static uint8_t wdt_timeout = 0xff;   // watchdog period in use (WDTO_*)
+static volatile uint8_t wdt_wakes;  // watchdog interrupts so far
+static uint8_t wdt_frac;            // fraction of a tick not yet in uptime
+
+ISR(WDT_vect) {
+  uint16_t t = wdt_frac + (wdt_q8 << wdt_timeout);
+  uptime += t >> 8;
+  wdt_frac = t;
+  ++wdt_wakes;
+}
+
+void Cal_wdt() {
+  uint8_t woke, ovf = 0, n, shift = clk_shift;
+  uint32_t q8;
+
+  if( TCCR0B ) return;          // Timer0 is busy with the buzzer, next time
+  Sleep_now(1, WDTO_15MS);      // start right after a tick
+  Clock_set(0);                 // and measure in full CPU cycles
+  TCCR0A = 0;
+  TCNT0 = 0;
+  Clear_tifr(1 << TOV0);
+  TCCR0B = (1 << CS01) | (1 << CS00); // Timer0 at CK/64
+  woke = wdt_wakes;
+  while( woke==wdt_wakes ) {    // count CPU cycles until the next one
+    if( TIFR & (1 << TOV0) ) { Clear_tifr(1 << TOV0); ++ovf; }
+  }
+  n = TCNT0;
+  if( (TIFR & (1 << TOV0)) && n<128 ) ++ovf; // overflowed just now
+  TCCR0B = 0;
+
+  Clock_set(shift);
+
+  q8 = ((((uint32_t)ovf << 8) | n)*256 + TICK_T0/2)/TICK_T0;
+  if( q8>192 && q8<320 ) wdt_q8 = q8;   // ignore measurements gone wrong
+}
+
+void Config_wdt(uint8_t timeout) {
+  uint8_t sreg = SREG;
 
-void Sleep_now(uint8_t periods, uint8_t timeout) {
   cli();
-  wdt_reset();
-  wdt_disable();
+  wdt_timeout = timeout;
   // correct WDP3 location
   timeout |= ((timeout&(1<<3))<<2);
   timeout &=~(1<<3);
   MCUSR = 0x00;
+  wdt_reset();                  // start the new period from zero
   WDTCR = (1<<WDE) | (1<<WDCE); // enable watchdog
   WDTCR = (1<<WDIE) | timeout;  // watchdog interrupt instead of reset
   //+reset, timeout can be 15,30,60,120,250,500ms or 1,2,4,8s
-  sei();
-  for( ; periods>0; --periods) {
-    set_sleep_mode(SLEEP_MODE_PWR_DOWN);  // set type of sleepmode
+  SREG = sreg;
+}
+
+void Sleep_now(uint8_t periods, uint8_t timeout) {
+  uint8_t woke, idle;
+#if COUNTERS
+  uint16_t t;
+#endif
+
+  if( timeout!=wdt_timeout ) Config_wdt(timeout);
+  idle = led_running || TCCR0A; // LEDs and buzzer need the timer clocks
+  set_sleep_mode(idle ? SLEEP_MODE_IDLE : SLEEP_MODE_PWR_DOWN);
+  if( !idle ) {
     power_all_disable();                  // disable unneeded loads
-    wdt_reset();                          // timer should start at zero
-    sleep_enable();                       // approach sleep mode
-    sleep_mode();                         // enter sleep mode (confirm)
-    sleep_disable();                      // entrance point when woken up
-    wdt_disable();
+#if DEEP_SLEEP
+    Park_pins();
+#endif
+  }
+  for( ; periods>0; --periods) {
+    cli();
+    woke = wdt_wakes;
+#if COUNTERS
+    t = uptime;
+#endif
+    while( woke==wdt_wakes ) {            // other interrupts go back to sleep
+      sleep_enable();                     // approach sleep mode
+#if DEEP_SLEEP
+      if( !idle ) sleep_bod_disable();    // timed, sleep within 3 cycles
+#endif
+      sei();                              // sleep before any interrupt runs
+      sleep_cpu();                        // enter sleep mode (confirm)
+      sleep_disable();                    // entrance point when woken up
+      cli();
+    }
+#if COUNTERS
+    if( idle ) ctr.awake += uptime-t;
+    else ++ctr.wakes;
+#endif
+    sei();
+  }
+  if( !idle ) {
     power_all_enable();                   // re-enable the loads
+#if DEEP_SLEEP
+    DIDR0 = DIDR_AWAKE;                   // the button needs its input back
+#endif
   }
 }
 
+#if DEEP_SLEEP
+void Park_pins() {
+  PORTB &= ~PARK_MASK;          // no pull-ups, nothing driven high
+  DDRB |= PARK_MASK;            // all low: no LED lit, pad discharged, no
+  DIDR0 = PARK_MASK;            // floating inputs and no input buffers
+}
+#endif
+
+//####################################################################### Clock
+
+void Clock_set(uint8_t shift) {
+  uint8_t sreg = SREG;
+
+  cli();
+  CLKPR = (1 << CLKPCE);        // unlock the prescaler for four cycles
+  CLKPR = shift;
+  clk_shift = shift;
+  if( TCCR1 & 0x0f )            // keep the tick of a running Timer1
+    TCCR1 = (TCCR1 & 0xf0) | (LED_CS-shift);
+  SREG = sreg;
+}
+
+//############################################################# Supply voltage
+
+static uint8_t vcc_q6 = 64; // led_q6 for the supply voltage alone
+
+uint16_t Get_vcc() {
+  uint8_t shift = clk_shift;
+  uint16_t adc;
+
+  Clock_set(0);
+  ADMUX = (1 << MUX3) | (1 << MUX2);    // bandgap against VCC as reference
+  ADCSRA = (1 << ADEN) | (1 << ADPS2) | (1 << ADPS1); // CK/64 = 125 kHz
+  _delay_ms(1);                         // let the bandgap settle
+  ADCSRA |= (1 << ADSC);
+  while( ADCSRA & (1 << ADSC) );
+  adc = ADC;
+  ADCSRA = 0;                           // ADC off, it draws current
+  Clock_set(shift);
+
+  if( adc ) vcc = (uint16_t)(1100UL*1024/adc);
+  // LED current goes with the voltage left over after the LED, the on time
+  // goes against it, so the LEDs stay as bright as at VCC_NOM
+  adc = vcc>LED_VF+(VCC_NOM-LED_VF)/3 ? vcc-LED_VF : (VCC_NOM-LED_VF)/3;
+  vcc_q6 = (64UL*(VCC_NOM-LED_VF) + adc/2)/adc;
+  led_q6 = ((uint16_t)vcc_q6*amb_q6 + 32) >> 6;
+  return vcc;
+}
+
 //###################################################################Indicators
 
-void Set_leds(int led) { // Same as Robin's version except for white spaces.
-  switch (led) {
-    case 2:         // LED1
-      DDRB |= (1 << DDB3);  DDRB |= (1 << DDB1);  DDRB &= ~(1 << DDB4);
-      PORTB &= ~(1 << 3);   PORTB &= ~(1 << 4);   PORTB |= (1 << 1);
-    break; case 3:  // LED2
-      DDRB |= (1 << DDB3);  DDRB |= (1 << DDB1);  DDRB &= ~(1 << DDB4);
-      PORTB &= ~(1 << 1);   PORTB &= ~(1 << 4);   PORTB |= (1 << 3);
-    break; case 4:  // LED3
-      DDRB |= (1 << DDB3);  DDRB |= (1 << DDB4);  DDRB &= ~(1 << DDB1);
-      PORTB &= ~(1 << 1);   PORTB &= ~(1 << 4);   PORTB |= (1 << 3);
-    break; case 5:  // LED4 (button side)
-      DDRB |= (1 << DDB3);  DDRB |= (1 << DDB4);  DDRB &= ~(1 << DDB1);
-      PORTB &= ~(1 << 1);   PORTB &= ~(1 << 3);   PORTB |= (1 << 4);
-    break; case 0:  // LED5 (other color)
-      DDRB |= (1 << DDB1);  DDRB |= (1 << DDB4);  DDRB &= ~(1 << DDB3);
-      PORTB &= ~(1 << 3);   PORTB &= ~(1 << 1);   PORTB |= (1 << 4);
-    break; case 1:  // LED6
-      DDRB |= (1 << DDB1);  DDRB |= (1 << DDB4);  DDRB &= ~(1 << DDB3);
-      PORTB &= ~(1 << 3);   PORTB &= ~(1 << 4);   PORTB |= (1 << 1);
-    break; default: // turn all LEDs off
-      DDRB &= ~(1 << DDB1) & ~(1 << DDB3) & ~(1 << DDB4);
-      PORTB &= ~(1 << 1) & ~(1 << 3) & ~(1 << 4);;
-    break;
+static const uint8_t led_pat[LED_N][2] PROGMEM = {  // DDRB, PORTB
+  LED_PAT(4, 1),            // LED5 (other color)
+  LED_PAT(1, 4),            // LED6
+  LED_PAT(1, 3),            // LED1
+  LED_PAT(3, 1),            // LED2
+  LED_PAT(3, 4),            // LED3
+  LED_PAT(4, 3)             // LED4 (button side)
+};
+
+#define G4(i) GAMMA(i), GAMMA((i)+1), GAMMA((i)+2), GAMMA((i)+3)
+static const uint8_t gamma_tab[BRIGHT_N] PROGMEM = {
+  G4(0), G4(4), G4(8), G4(12)
+};
+
+// Inlined into the LED engine's interrupt, which then calls no function and
+// only saves the registers it uses
+static inline void Led_pins(uint8_t ddr, uint8_t port) {
+  PORTB &= ~LED_MASK;       // pins low first, so nothing lights in between
+  DDRB = (DDRB & ~LED_MASK) | ddr;
+  PORTB |= port;
+}
+
+void Set_leds(int led) {
+  uint8_t ddr = 0, port = 0;
+
+  if( led>=0 && led<LED_N ) {
+    ddr = pgm_read_byte(&led_pat[led][0]);
+    port = pgm_read_byte(&led_pat[led][1]);
   }
+  Led_pins(ddr, port);
 }
 
-void Shine_led(int led, uint32_t duration) {
-  duration = (duration*10000)/T_CYC;
-  for( ; duration>0; --duration ) {
-        Set_leds(led);    _delay_us(T_ON);
-        Set_leds( -1);    _delay_us(T_OFF);
+void Shine_led(int led, uint16_t frames) {
+  Led_clear();
+  Led_level(led, BRIGHT_MAX);
+  Led_start();
+  Led_wait(frames);
+  Led_stop();
+}
+
+//################################################################## LED engine
+
+static uint8_t led_slot;    // slot (= LED) the engine is currently at
+static uint8_t led_on;      // on time of that slot, zero once it is lit
+#if AMBIENT
+static volatile uint8_t led_hold; // Get_light() has the pins, keep time only
+#define LED_HELD led_hold
+#else
+#define LED_HELD 0
+#endif
+
+ISR(TIMER1_COMPA_vect) {
+  uint8_t s = led_slot;
+
+  if( led_on ) {            // dark part of the slot is over, light the led
+    OCR1A += led_on;        // first thing, it may be only TCK_MIN ahead
+    led_on = 0;
+    if( !LED_HELD )
+      Led_pins(pgm_read_byte(&led_pat[s][0]), pgm_read_byte(&led_pat[s][1]));
+  } else {                  // slot is over, go dark for the next one
+    if( !LED_HELD ) Led_pins(0, 0);
+    if( ++s>=LED_N ) { s = 0; ++led_frames; }
+    led_slot = s;
+    led_on = led_fb[s];
+    OCR1A += TCK_SLOT-led_on;
   }
 }
 
+void Led_start() {
+  led_running = 1;
+  Set_leds(-1);
+  led_slot = LED_N-1;       // first compare match starts a new frame
+  led_on = 0;
+  TCCR1 = 0;
+  TCNT1 = 0;
+  OCR1A = TCK_MIN;
+  Clear_tifr(1 << OCF1A);   // drop stale compare matches
+  TIMSK |= (1 << OCIE1A);
+  TCCR1 = LED_CS-clk_shift; // normal mode, Timer1 runs freely
+  sei();
+}
+
+void Led_stop() {
+  led_running = 0;
+  TIMSK &= ~(1 << OCIE1A);
+  TCCR1 = 0;
+  Set_leds(-1);
+}
+
+void Led_clear() {
+  uint8_t i;
+  for( i=0; i<LED_N; ++i ) led_fb[i] = 0;
+}
+
+void Led_set(uint8_t led, uint8_t ticks) {
+  if( ticks>0 && ticks<TCK_MIN ) ticks = TCK_MIN;
+  if( ticks>TCK_SLOT-TCK_MIN ) ticks = TCK_SLOT-TCK_MIN;
+  led_fb[led] = ticks;
+}
+
+void Led_level(uint8_t led, uint8_t level) {
+  uint16_t t = ((uint16_t)pgm_read_byte(&gamma_tab[level])*led_q6 + 32) >> 6;
+
+  // led_q6 goes up to 3.0, clamp before the on time is cut to 8 bits
+  Led_set(led, t<TCK_SLOT-TCK_MIN ? t : TCK_SLOT-TCK_MIN);
+}
+
+void Led_update() {
+  uint8_t i, any = 0;
+
+  for( i=0; i<LED_N; ++i ) any |= led_fb[i];
+  if( any && !led_running ) Led_start();
+  if( !any && led_running ) Led_stop();
+}
+
+void Led_wait(uint16_t frames) {
+  uint16_t now;
+
+  cli(); now = led_frames; sei();
+  frames += now;
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  while( (int16_t)(now-frames)<0 ) {
+    sleep_mode();           // woken by the next engine interrupt
+    cli(); now = led_frames; sei();
+  }
+}
+
+//############################################################### Ambient light
+
+#if AMBIENT
+uint8_t Get_light() {
+  const uint8_t a = pgm_read_byte(&led_pat[AMB_LED][1]);          // anode
+  const uint8_t k = pgm_read_byte(&led_pat[AMB_LED][0]) & ~a;     // cathode
+  uint8_t n, t, q, tcnt, last, shift = clk_shift;
+  uint16_t tck = 0, lim = AMB_TCK;
+
+  Clock_set(0);                 // the delay is for the full clock
+  if( led_running ) {           // the engine goes on, dark for a frame at most
+    if( lim>LED_N*TCK_SLOT ) lim = LED_N*TCK_SLOT;
+  } else {
+    TCNT1 = 0;                  // Timer1 runs at the engine's tick anyway
+    TCCR1 = LED_CS;
+  }
+  led_hold = 1;
+  Set_leds(-1);
+  PORTB |= k;                   // reverse bias: cathode high, anode low
+  DDRB |= a | k;
+#if DEEP_SLEEP
+  DIDR0 = DIDR_AWAKE & ~k;      // the cathode is read digitally for once
+#endif
+  _delay_us(10);                // charge the junction, the twin lights
+  last = TCNT1;
+  DDRB &= ~k;                   // float the cathode (pull-up until the next
+  PORTB &= ~k;                  // line, driving it low would discharge it)
+  while( (PINB & k) && tck<lim ) {  // Timer1 wraps every 256 ticks, sum up
+    tcnt = TCNT1;
+    tck += (uint8_t)(tcnt-last);
+    last = tcnt;
+  }
+  n = tck<lim ? tck/AMB_TCK_Q : 255;
+  Set_leds(-1);
+  led_hold = 0;                 // the engine has the pins from its next match
+  if( !led_running ) TCCR1 = 0;
+#if DEEP_SLEEP
+  DIDR0 = DIDR_AWAKE;
+#endif
+  Clock_set(shift);
+
+  for( q=64, t=n; t>AMB_BRIGHT && q>AMB_MIN_Q6; t>>=1 ) q -= q >> 2;
+  amb_q6 = q<AMB_MIN_Q6 ? AMB_MIN_Q6 : q;
+  led_q6 = ((uint16_t)vcc_q6*amb_q6 + 32) >> 6;
+  return n;
+}
+#endif
+
+//################################################################### Sequencer
+
+static const uint8_t *seq_pc[SEQ_N];  // step each channel is playing
+
+void Seq_play(uint8_t ch, const uint8_t *seq) {
+  if( ev_armed & (1 << SEQ_EV(ch)) ) Seq_end(ch);
+  Seq_step(ch, seq);
+}
+
+void On_seq(uint8_t ch) {
+  Seq_end(ch);
+  Seq_step(ch, seq_pc[ch]+2);
+}
+
+void Seq_end(uint8_t ch) {
+  uint8_t op = pgm_read_byte(seq_pc[ch]);
+
+  Led_set(SEQ_LED(op), 0);
+  if( op & SEQ_BUZZ ) Stop_buzz();
+  ev_armed &= ~(1 << SEQ_EV(ch));
+}
+
+void Seq_step(uint8_t ch, const uint8_t *pc) {
+  uint8_t op = pgm_read_byte(pc), ticks = pgm_read_byte(pc+1);
+
+  if( !ticks ) {            // control step
+    if( !op ) return;       // SEQ_END
+    pc -= 2*op;             // SEQ_LOOP
+    op = pgm_read_byte(pc);
+    ticks = pgm_read_byte(pc+1);
+  }
+  seq_pc[ch] = pc;
+  Led_level(SEQ_LED(op), op & 0x0f);
+  if( op & SEQ_BUZZ ) Start_buzz();
+  Schedule(SEQ_EV(ch), ticks);
+}
+
+//###################################################################### Buzzer
+
+static const uint8_t tone_tab[BUZZ_N][2] PROGMEM = {  // OCR0A high, low
+  TONE(2794), TONE(2960), TONE(3136), TONE(3322), TONE(3520), TONE(3729),
+  TONE(3951), TONE(4186), TONE(4435), TONE(4699), TONE(4978), TONE(5274)
+};
+
+#if BUZZ_DUTY<50
+static uint8_t buzz_ocr[2]; // compares of the pulse and of the pause
+
+ISR(TIMER0_COMPA_vect) {    // end of the pulse or of the pause
+  PORTB ^= (1 << PB0);
+  OCR0A = buzz_ocr[!(PORTB & (1 << PB0))];
+}
+#endif
+
+static uint8_t buzz_shift = CLK_SLOW; // clock to go back to when it stops
+
 void Start_buzz() {
+  buzz_shift = clk_shift;
+  Clock_set(0);        // the tone is made for the full clock
   DDRB |= (1 << DDB0); // set PB0 output
-
-  // Fast PWM, OC0A, non-inverting, divide clock by 8 (~4kHz @ clk 8MHz)
-  TCCR0A = (1 << COM0A1) | (1 << WGM01) | (1 << WGM00);
-  TCCR0B = (1 << CS01);
-  OCR0A = 128;  // half duty cycle
+  TCNT0 = 0;
+#if BUZZ_DUTY<50
+  buzz_ocr[0] = pgm_read_byte(&tone_tab[buzz_tone][0]);
+  buzz_ocr[1] = pgm_read_byte(&tone_tab[buzz_tone][1]);
+  PORTB |= (1 << PB0);              // the first pulse starts now
+  OCR0A = buzz_ocr[0];
+  Clear_tifr(1 << OCF0A);
+  TIMSK |= (1 << OCIE0A);
+  TCCR0A = (1 << WGM01);            // CTC, the interrupt shapes the pulses
+#else
+  OCR0A = pgm_read_byte(&tone_tab[buzz_tone][0]);
+  TCCR0A = (1 << COM0A0) | (1 << WGM01); // CTC, toggle OC0A: half duty
+#endif
+  TCCR0B = (1 << CS01);             // Timer0 at CK/8
 }
 
 void Stop_buzz() {
-  TCCR0A = 0x0;         // stop timer
+  TCCR0A = 0x0;         // disconnect the buzzer
+  TCCR0B = 0x0;         // stop timer
+#if BUZZ_DUTY<50
+  TIMSK &= ~(1 << OCIE0A);
+  PORTB &= ~(1 << PB0); // end a pulse that was going on
+#endif
+#if !TELEMETRY           // else PB0 stays an output, the line idles low
   DDRB &= ~(1 << DDB0); // set PB0 as input
+#endif
+  Clock_set(buzz_shift);
 }
 
-void Play_sound() {
-    unsigned i;
-    unsigned char j;
-    unsigned char duration[] = {2, 1, 1};
-
-    for(i=0; i<11; ++i) {
-        Start_buzz();
-        for(j=0; j<duration[i%3];++j) Shine_led(0, 35);
-        Stop_buzz();
-        _delay_ms(50);
+#if BUZZ_TUNE
+void Tune_buzz() {
+  uint8_t round, i, j, old = buzz_tone;
+
+  for( j=0; btn_held; ) {             // held on purpose, not just brushed?
+    if( j<TUNE_HOLD*8 && ++j==TUNE_HOLD*8 ) {
+      Start_buzz();  Shine_led(0, MS2FRAME(100));  Stop_buzz();  // let go
     }
+    if( btn_held>=BTN_STUCK ) return; // never let go: it is the baseline
+    Scan_button();
+    Sleep_now(1, WDTO_120MS);
+  }
+  if( j<TUNE_HOLD*8 ) return;
+  for( round=0; round<TUNE_ROUNDS; ++round )
+    for( buzz_tone=0; buzz_tone<BUZZ_N; ++buzz_tone ) {
+      Start_buzz();
+      Led_clear();
+      Led_level(buzz_tone >> 1, buzz_tone&1 ? BRIGHT_MAX/3 : BRIGHT_MAX);
+      Led_start();
+      Led_wait(MS2FRAME(TUNE_MS));
+      Led_stop();
+      Stop_buzz();
+      for( j=0; j<MS2TICK(2*TUNE_MS); ++j ) {  // time to react
+        if( Scan_button()==BTN_PRESS ) {
+          Save_cal();
+          for( i=0; i<2; ++i ) {
+            Start_buzz();  Shine_led(buzz_tone >> 1, MS2FRAME(100));
+            Stop_buzz();   Sleep_now(1, WDTO_120MS);
+          }
+          while( btn_held ) { Scan_button(); Sleep_now(1, WDTO_15MS); }
+          return;
+        }
+        Sleep_now(1, WDTO_15MS);
+      }
+    }
+  buzz_tone = old;
 }
+#endif
 
 //################################################################# Cap sensing
 
+#if SENSE_ADC
+unsigned Get_time() {
+    const uint8_t mask = (1 << PB2);
+    uint8_t shift = clk_shift, x;
+
+    Clock_set(0);
+    ADCSRA = (1 << ADEN) | (1 << ADPS1) | (1 << ADPS0); // CK/8, 8 bits suffice
+    ADMUX = (1 << ADLAR);   // ADC0 is RESET, at VCC: charge the S/H capacitor
+    PORTB &= ~mask;         // pull-up off
+    DDRB  |=  mask;         // discharge the pad
+    _delay_us(5);           // while the S/H capacitor charges
+    DDRB  &= ~mask;         // let the pad float
+    ADMUX = (1 << ADLAR) | (1 << MUX0);  // ADC1: the pad takes its share
+    ADCSRA |= (1 << ADSC);
+    while( ADCSRA & (1 << ADSC) );
+    x = ADCH;
+    ADCSRA = 0;             // ADC off, it draws current
+    Clock_set(shift);
+    return 255-x;           // larger pad capacity, less charge left
+}
+#else
 unsigned Get_time() {
     unsigned i = 0;
     const uint8_t mask = (1 << PB2);
+    uint8_t sreg = SREG;
+    uint8_t tccr, tcnt, shift = clk_shift;
+
+    cli();                  // the LED engine shares Timer1, pause it
+    Clock_set(0);           // count the charge time in full CPU cycles
+    tccr = TCCR1;
+    tcnt = TCNT1;
+#if SENSE_PLL
+    PLLCSR = (1 << PLLE);   // start the PLL, it locks while the pad discharges
+#endif
 
     // MEASURE THE TIME FOR THE BUTTON TO CHARGE
     PORTB &= ~mask;         // pull-up off
@@ -231,7 +856,14 @@ unsigned Get_time() {
     while( PINB & mask );   // wait till discharge complete
     _delay_us(10);          // wait some more for good measure
     DDRB  &= ~mask;         // set pin to input
-    TCCR1 = (1 << CS10);    // enable timer at CPU frequency
+    TCNT1 = 0;              // keep the LED engine's count from overflowing
+    Clear_tifr(1 << TOV1);  // clear overflow flag left by the LED engine
+#if SENSE_PLL
+    _delay_us(90);          // the PLL needs 100us to lock
+    while( !(PLLCSR & (1 << PLOCK)) );
+    PLLCSR |= (1 << PCKE);  // Timer1 counts at 64MHz
+#endif
+    TCCR1 = (1 << CS10) + btn_range; // enable timer at clock / 2^btn_range
 
     PORTB |=  mask;         // internal pull-up on
     TCNT1 = 0;              // reset timer
@@ -239,27 +871,264 @@ unsigned Get_time() {
     i=TCNT1;                // get time
     TCCR1 = 0;              // disable timer
     if( TIFR&(1<<TOV1) ) {  // If there was a timer overflow
-      i=255;
-      TIFR |= (1<<TOV1);    // Clear timeout flag
+      i=255;                // touched hard, or the range is still too fine
     }
+#if SENSE_PLL
+    PLLCSR = (1 << PLLE);   // Timer1 back on the CPU clock, then PLL off
+    PLLCSR = 0;
+#endif
 
     PORTB &= ~mask;         // pull-up off
+    TCNT1 = tcnt;           // resume the LED engine where it was
+    Clear_tifr((1 << OCF1A) | (1 << TOV1)); // flags raised while measuring
+    TCCR1 = tccr;
+    Clock_set(shift);
+    SREG = sreg;
     return i;
 }
+#endif
 
 unsigned Get_cal() {
     int i;
     uint16_t stime = 0;
+    uint32_t ssq = 0;
+    unsigned t;
 
     _delay_ms(10);  // wait till controller has settled
 
-    // Measure a couple discharge times, then calculate the average
-    for(i=1<<3; i>0; --i) stime += Get_time();
+#if !SENSE_ADC
+    // Auto-range: finest Timer1 clock that keeps the button below half scale
+    for( btn_range=0; btn_range<RANGE_MAX && Get_time()>=128; ++btn_range );
+#endif
+    // Measure a couple discharge times, then calculate mean and variance
+    for(i=1<<3; i>0; --i) { t = Get_time(); stime += t; ssq += t*t; }
+    btn_base = stime << 5;  // mean in fixed point 8.8
+    ssq = (ssq << 5) - (((uint32_t)btn_base*btn_base) >> 8);
+    btn_var = ssq>0xffff ? 0xffff : ssq;
+    btn_held = 0;
     stime >>= 3;    // division to get the mean
     // Indicate Cal Error
     if( stime >= 255 || stime < 2 ) { // constant too large or small
-      for(i=0; i<5; ++i) { Shine_led(3, 50); Sleep_now(1, WDTO_500MS); }
+      for(i=0; i<5; ++i) {
+        Shine_led(3, MS2FRAME(500));
+        Sleep_now(1, WDTO_500MS);
+      }
+#if COUNTERS
+      ++ctr.cal_fail;
+      Save_ctr();
+#endif
       return stime;
     }
-    return stime + BTN_THRESHOLD;
+    Save_cal();
+    return Btn_threshold();
+}
+
+//########################################################## Baseline tracking
+
+static uint8_t Isqrt(uint16_t x) {
+    uint8_t r = 0, b;
+    for( b=0x80; b; b>>=1 )
+      if( (uint16_t)(r|b)*(r|b)<=x ) r |= b;
+    return r;
+}
+
+static unsigned Btn_release() {
+    return cal-((cal-((btn_base+128) >> 8)) >> 1);
+}
+
+unsigned Btn_threshold() {
+    // square root of the variance (8.8) is the standard deviation in 12.4
+    uint8_t delta = (BTN_SIGMA*Isqrt(btn_var) + 8) >> 4;
+
+    if( delta<BTN_THRESHOLD ) delta = BTN_THRESHOLD;
+    return ((btn_base + 128) >> 8) + delta;
+}
+
+// x/2^n rounded up, as an arithmetic shift rounds a negative step down
+#define SHR_UP(x, n) ((x) ? (((x)-1) >> (n)) + 1 : 0)
+
+void Track_button(unsigned x) {
+    uint16_t xb = x << 8;   // x is at most 255, so 8.8 fits 16 bits
+    uint16_t d, sq;
+    uint8_t d4;             // size of the deviation in fixed point 12.4
+
+    // IIR low pass, falls faster than it rises so a hand does not drag it up.
+    // Both directions in unsigned 16 bits, no 32 bit arithmetic on a scan.
+    if( xb>=btn_base ) {
+      d = xb-btn_base;
+      btn_base += d >> BTN_TRACK;
+      d4 = d>=(255 << 4) ? 255 : d >> 4;
+    } else {
+      d = btn_base-xb;
+      btn_base -= SHR_UP(d, BTN_TRACK-2);
+      d4 = d>=(255 << 4) ? 255 : SHR_UP(d, 4);
+    }
+    sq = (uint16_t)d4*d4;
+    if( sq>=btn_var ) btn_var += (sq-btn_var) >> BTN_TRACK;
+    else btn_var -= SHR_UP(btn_var-sq, BTN_TRACK);
+    cal = Btn_threshold();
+}
+
+static uint8_t Btn_decide(unsigned x) {
+    uint8_t i;
+
+    if( btn_held ) {        // pressed, wait for the release (hysteresis)
+      if( x<=Btn_release() ) btn_held = 0;
+      else if( ++btn_held>BTN_STUCK ) {   // something rests on the button
+        btn_base = x << 8;
+        btn_held = 0;
+        cal = Btn_threshold();
+      }
+      return BTN_NEAR;
+    }
+    if( x>cal ) {           // debounce: a few more samples have to agree
+      for( i=0; i<BTN_DEBOUNCE; ++i )
+        if( Get_time()<=cal ) return BTN_NEAR;
+      btn_held = 1;
+      return BTN_PRESS;
+    }
+    Track_button(x);        // idle scan, follow the drift
+    return x>Btn_release() ? BTN_NEAR : BTN_QUIET;
+}
+
+uint8_t Scan_button() {
+    unsigned x = Get_time();
+    uint8_t b = Btn_decide(x);
+
+#if TELEMETRY
+    Tlm_send(TLM_SAMPLE | b, x, btn_base);
+#endif
+    return b;
+}
+
+//####################################################### Persistent settings
+
+static struct Ee_cal ee_ring[EE_SLOTS] EEMEM; // wear-levelled calibrations
+static uint8_t ee_slot;     // slot of the newest record
+
+static uint8_t Ee_check(const struct Ee_cal *r) {
+    const uint8_t *b = (const uint8_t *)r;
+    uint8_t i, c = 0x5a;    // an erased record (all 0xff) does not match
+
+    for( i=0; b+i<&r->check; ++i ) c -= b[i];
+    return c;
+}
+
+uint8_t Load_cal() {
+    struct Ee_cal r;
+    uint8_t i, found = 0, seq = 0, above = 0;
+    unsigned x = 0, t, base;
+
+    for( i=0; i<EE_SLOTS; ++i ) {   // find the newest valid record
+      eeprom_read_block(&r, &ee_ring[i], sizeof r);
+      if( r.check!=Ee_check(&r) ) continue;
+      if( !found || (int8_t)(r.seq-seq)>0 ) {
+        found = 1;
+        seq = r.seq;
+        ee_slot = i;
+        btn_base = r.base;
+        btn_var = r.var;
+        btn_range = r.range;
+        if( r.tone<BUZZ_N ) buzz_tone = r.tone;
+      }
+    }
+    if( !found ) return 0;
+
+    _delay_ms(10);          // wait till controller has settled
+    cal = Btn_threshold();
+    for( i=1<<2; i>0; --i ) { x += t = Get_time(); above += t>cal; }
+    x >>= 2;
+    base = (btn_base+128) >> 8;
+    if( x+(cal-base)<base ) return 0; // much faster than cached: recalibrate
+    if( above==1<<2 ) return 0;       // touched or drifted, no telling which
+    return 1;
+}
+
+void Save_cal() {
+    struct Ee_cal r;
+
+    r.base = btn_base;
+    r.var = btn_var;
+    r.range = btn_range;
+    r.tone = buzz_tone;
+    r.seq = eeprom_read_byte(&ee_ring[ee_slot].seq)+1;
+    r.check = Ee_check(&r);
+    if( ++ee_slot>=EE_SLOTS ) ee_slot = 0;
+    eeprom_update_block(&r, &ee_ring[ee_slot], sizeof r);
+}
+
+#if COUNTERS
+static struct Ee_ctr ee_ctr EEMEM;  // activity totals, read by "make counters"
+
+// Add n to a total in the EEPROM, which counts from 0 if it was erased
+static void Ee_add32(uint32_t *total, uint16_t n, uint8_t erased) {
+    eeprom_update_dword(total, (erased ? 0 : eeprom_read_dword(total))+n);
+}
+
+static void Ee_add16(uint16_t *total, uint8_t n, uint8_t erased) {
+    eeprom_update_word(total, (erased ? 0 : eeprom_read_word(total))+n);
+}
+
+// Field by field, a copy of struct Ee_ctr would take 20 B of stack. wakes goes
+// last, so a save cut short by the battery finds the totals erased next time.
+void Save_ctr() {
+    uint8_t erased = eeprom_read_dword(&ee_ctr.wakes)==0xffffffff;
+
+    Ee_add32(&ee_ctr.scans, ctr.scans, erased);
+    Ee_add32(&ee_ctr.awake, ctr.awake, erased);
+    Ee_add16(&ee_ctr.touches, ctr.touches, erased);
+    Ee_add16(&ee_ctr.done, ctr.done, erased);
+    Ee_add16(&ee_ctr.aborted, ctr.aborted, erased);
+    Ee_add16(&ee_ctr.cal_fail, ctr.cal_fail, erased);
+    Ee_add32(&ee_ctr.wakes, ctr.wakes, erased);
+    ctr = (struct Ctr){ 0 };
+}
+#endif
+
+//################################################################# Telemetry
+
+#if TELEMETRY
+// Whether the LED engine's next compare match is too close for a byte
+static inline uint8_t Tlm_busy() {
+  return (TIMSK & (1 << OCIE1A)) && (uint8_t)(OCR1A-TCNT1)<=TLM_TCK;
+}
+
+static void Tlm_byte(uint8_t b) {
+  uint16_t frame = ~(b << 1) & 0x1ff; // inverted: start bit high, stop low
+  uint8_t i, sreg = SREG;
+
+  do {                          // an interrupt would stretch a bit, so wait
+    SREG = sreg;                // for a gap in the LED engine, with its
+    while( Tlm_busy() );        // interrupt on to move OCR1A meanwhile
+    cli();
+  } while( Tlm_busy() );
+  TCNT0 = 0;                    // the frame starts now, whenever that is
+  Clear_tifr(1 << OCF0A);
+  for( i=10; i; --i ) {
+    if( frame & 1 ) PORTB |= (1 << PB0);
+    else PORTB &= ~(1 << PB0);
+    while( !(TIFR & (1 << OCF0A)) );  // Timer0 says when the bit is over
+    Clear_tifr(1 << OCF0A);
+    frame >>= 1;
+  }
+  SREG = sreg;
+}
+
+void Tlm_send(uint8_t type, uint16_t a, uint16_t b) {
+  uint8_t rec[TLM_LEN-1] = { type, a >> 8, a, b >> 8, b };
+  uint8_t i, c = 0x5a, shift = clk_shift;
+
+  if( TCCR0B ) return;          // the buzzer drives PB0
+  Clock_set(0);                 // bit times are counted in F_CPU cycles
+  TCCR0A = (1 << WGM01);        // CTC, a compare match every bit time
+  OCR0A = TLM_OCR;
+  TCNT0 = 0;
+  Clear_tifr(1 << OCF0A);
+  TCCR0B = (1 << CS01);         // Timer0 at CK/8
+  for( i=0; i<TLM_LEN-1; ++i ) { Tlm_byte(rec[i]); c -= rec[i]; }
+  Tlm_byte(c);
+  TCCR0B = 0;
+  TCCR0A = 0;
+  Clock_set(shift);
 }
+#endif
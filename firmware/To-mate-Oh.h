@@ -7,8 +7,12 @@
  * <a href="http://pomodorotechnique.com">pomodoro technique</a>.
  *
  * User input is sensed via a time integration to sense capacity in the
- * "button". An average charging time is computed before hand. This time in turn
- * then serves as a calibration value to detect the button press.
+ * "button". An average charging time is computed before hand (or taken from
+ * the EEPROM, if the one stored at the end of the last session still fits).
+ * This time in turn then serves as a calibration value to detect the button
+ * press. While the button is not touched, the average and the noise around it
+ * are tracked, so the detection threshold follows slow drifts and stays clear
+ * of the noise.
  *
  * The charging time changes with the capacity of the button, which in turn is
  * changed when a human comes near the button. A daramtic increase in charging
@@ -56,7 +60,10 @@
  *
  * The following files comprise To-mate-Oh: ./docu/docu.pdf, ./docu/doxygen.cfg,
  * ./docu/doxygen.sh, ./firmware/Makefile, ./firmware/To-mate-Oh.c,
- * ./firmware/To-mate-Oh.h, ./hardware/To-mate-Oh.brd,
+ * ./firmware/To-mate-Oh.h, ./firmware/hal.h, ./firmware/host/avr-mock.c,
+ * ./firmware/host/avr-mock.h, ./firmware/host/sim-avr.c,
+ * ./firmware/host/telemetry.c, ./firmware/host/counters.c,
+ * ./firmware/host/budgets.txt, ./hardware/To-mate-Oh.brd,
  * ./hardware/To-mate-Oh.sch, ./hardware/To-mate-Oh-board.png,
  * ./hardware/To-mate-Oh-etch.pdf, ./hardware/To-mate-Oh-schematic.pdf,
  * ./hardware/To-mate-Oh-prototype.jpg, ./hardware/To-mate-Oh-final.jpg,
@@ -211,17 +218,22 @@
  * positive contact. This is to avoid exposing an inserted battery to the USB
  * voltage, so **before programming, take the battery out.**
  *
+ * "make host" builds the firmware for Linux against a mock register file
+ * with a virtual clock (see ./firmware/hal.h and ./firmware/host/avr-mock.c).
+ * Running ./firmware/To-mate-Oh-host with the seconds at which the pad is
+ * touched simulates the device and reports how long it was awake, asleep and
+ * lighting its LEDs, without flashing a board.
+ *
  * If you change the firmware or fuse bits, be aware that the cap sensing and
  * led timing is very sensitive. In the ./firmware/To-mate-Oh.h are a few
  * settings related to LED PWM and timeouts (scroll way down in the .h file
  * until after this documentation).
  *
- * \note There is much room for optimization. For instance, one could get rid
- * of the delays by using a timer for the short led pulses and putting the
- * controller to sleep for the long ones (the watchdog timer can go down to 15
- * ms). The watchdog timer is not that accurate and temperature stable though.
- * Speaking of accuracy, the delay lengths could be adjusted for more accurate
- * timing.
+ * \note The LEDs are driven by Timer1 interrupts and the controller idles in
+ * between. In the long pauses it sleeps in power down and the watchdog timer
+ * keeps the time. The watchdog timer is not that accurate and temperature
+ * stable though, so it is measured against the CPU clock at start-up, when a
+ * pomodoro starts and every few minutes during a session.
  *
  * \section sec_usage Using the Board
  *
@@ -235,31 +247,172 @@
  * 3. If you wish to turn the timer off during _rest_ mode, click the button a
  * third time.
  *
+ * Built with GLANCE, the LEDs stay dark during _work_ to save the battery.
+ * Every ten seconds they flash the slices left, followed by a blink for every
+ * minute passed in the current slice. A click shows the progress for a few
+ * seconds, a second click while it shows aborts the pomodoro.
+ *
+ * To tune the buzzer to its loudest tone, hold the button while you insert
+ * the battery and let go. The To-mate-Oh then plays rising tones while the
+ * LEDs walk along. Touch the button right after the loudest one, it beeps
+ * twice to confirm.
+ *
  * When you insert a fresh battery, a calibration for the cap sense button is
  * performed. After a successful calibration the To-mate-Oh will circle through
  * its LEDs and beep. If you count the beeps or how often a different LED is
  * lit, it will give you the calibration constant. If the calibration fails, the
  * To-mate-Oh will blink LED2 for five seconds. Most likely the sense pad is
- * connected to a large capacity or ground then.
+ * connected to a large capacity or ground then. The calibration is kept in the
+ * EEPROM. On later power-ups it is only checked, which takes a fraction of a
+ * second, and the LEDs circle just once.
  *
  */
 
 
 // CONFIGURATION CONSTANTS
-#define BTN_THRESHOLD 2 ///< Threshold for the button to detect user input
+#define BTN_THRESHOLD 2 ///< Least rise of the charge time that is a touch
+#define BTN_SIGMA 4     ///< Rise in standard deviations of the noise to touch
+#define BTN_DEBOUNCE 2  ///< Extra samples that have to confirm a touch
+#define BTN_TRACK 5     ///< Shift of the IIR filters tracking the button
+#define BTN_STUCK 120   ///< Scans a touch may last before it is the baseline
 #define ON_TIME 5       ///< LED on time per PWN cycle in units of 100us
 #define DUTY    5       ///< Duty cycle of the LED
-
-
-// GLOBALS
-unsigned cal;           ///< Storage for the calibration values of the button
-unsigned char state;    ///< Current state the timer is in
+#define WORK_MIN 25     ///< Length of a pomodoro in minutes
+#define REST_MIN 5      ///< Length of the rest period in minutes
+#define WAIT_MIN 5      ///< Minutes to wait for the rest period to be started
+#define WDT_RECAL 5     ///< Minutes between calibrations of the watchdog
+#define SCAN_FAST 4     ///< Ticks between touch scans after activity (~64ms)
+#define SCAN_SLOW 64    ///< Most ticks between touch scans when idle (~1s)
+#define SCAN_BUSY 16    ///< Most ticks between scans in a session (~0.25s)
+#define SCAN_BACKOFF 8  ///< Quiet scans before the time between them doubles
+#ifdef HOST
+  #define SCAN_STATS 1  ///< Count scans and touch latency per state (mock)
+#else
+  #define SCAN_STATS 0  ///< Only the mock reads them, 25 B of SRAM on the chip
+#endif
+#define GAMMA_Q8 640    ///< Gamma of the brightness levels, fixed point 8.8
+#define CLK_SLOW 2      ///< CPU clock is F_CPU>>CLK_SLOW when not sensing
+#define EE_SLOTS 8      ///< Slots of the ring of calibrations in the EEPROM
+#define VCC_NOM  3000   ///< Supply voltage in mV ON_TIME is meant for
+#define VCC_LOW  2500   ///< Supply voltage in mV below which the battery is low
+#define VCC_CHECK 5     ///< Minutes between measurements of the supply voltage
+#define LED_VF   1900   ///< Forward voltage of the LEDs in mV
+#define DEEP_SLEEP 1    ///< Park pins and turn BOD off in power down (0 = off)
+#define SENSE_ADC 0     ///< Sense the button by ADC charge sharing (1 = on)
+#define SENSE_PLL 0     ///< Count the charge time with the 64MHz PLL (1 = on)
+#define RANGE_MAX 7     ///< Largest prescaler (2^n) for counting charge time
+#define TELEMETRY 0     ///< Send cap-sense records out on PB0 (1 = on)
+#define TLM_BAUD 38400  ///< Baud rate of the telemetry (8N1, inverted)
+#define COUNTERS 1      ///< Keep activity counters in the EEPROM (0 = off)
+#define GLANCE 0        ///< WORK dark, progress flashed and on touch (1 = on)
+#define GLANCE_EVERY 10 ///< Seconds between the progress flashes of GLANCE
+#define GLANCE_SHOW 4   ///< Seconds the full progress shows after a touch
+#define GLANCE_MS 150   ///< Length of a phase of a progress flash in ms
+#define AMBIENT 0       ///< Dim the LEDs in the dark, an LED senses it (1 = on)
+#define AMB_LED 2       ///< LED (index of Set_leds()) that senses the light
+#define AMB_BRIGHT 8    ///< Longest discharge (128us counts) that is bright
+#define AMB_MIN_Q6 16   ///< Dimmest LED scale in the dark, fixed point 2.6
+#define AMB_CHECK 1     ///< Minutes between measurements of the ambient light
+#define BUZZ_TONE 6     ///< Tone of the buzzer (tone_tab) until one is tuned
+#define BUZZ_DUTY 50    ///< Percent of a period the buzzer is driven, 30 to 50
+#define BUZZ_TUNE 1     ///< Tune the buzzer if held at start-up (0 = off)
+#define TUNE_HOLD 3     ///< Seconds the pad is held at start-up to tune
+#define TUNE_MS 250     ///< Length of each tone of the tuning sweep in ms
+#define TUNE_ROUNDS 3   ///< Times the tuning sweep plays before it gives up
 
 
 // VALUES FOR THE STAT VARIABLE
+#define IDLE 0          ///< Sleeping until the button is pressed
 #define WORK 1          ///< Timer is counting down a Pomodro (25min chunk)
 #define WAIT 3          ///< Waiting for user to start rest period
 #define REST 4          ///< 5 min rest
+#define STATE_N 5       ///< Size of arrays indexed by state
+
+
+// VALUES RETURNED BY Scan_button()
+#define BTN_QUIET 0     ///< Button is not touched
+#define BTN_PRESS 1     ///< Button was just touched
+#define BTN_NEAR  2     ///< Button is held or almost touched
+
+
+// EVENTS OF THE SCHEDULER (queued in ev_at and ev_armed)
+#define EV_SCAN   0     ///< Scan the touch button
+#define EV_MINUTE 1     ///< Another minute of the current state has passed
+#define EV_BLINK  2     ///< Next phase of a blinking LED or state animation
+#define EV_SOUND  3     ///< Next note of the indicator melody
+#define EV_FADE   4     ///< Dim the leading LED of the WORK display a step
+#define EV_GLANCE 5     ///< Next phase of the GLANCE display of WORK
+#define EV_N      6     ///< Number of events
+
+
+// SEQUENCES (steps of two bytes in flash: op, ticks; played by On_seq())
+#define SEQ_SOUND 0     ///< Channel of the melodies, outlasts states
+#define SEQ_ANIM  1     ///< Channel of the state animations
+#define SEQ_N     2     ///< Number of channels
+#define SEQ_EV(ch) ((ch)==SEQ_SOUND ? EV_SOUND : EV_BLINK) ///< Channel's event
+#define SEQ_BUZZ  0x80  ///< Op bit: buzzer on during the step
+#define SEQ_LED(op) (((op) >> 4) & 7) ///< LED of the step
+/** Step: light led at a brightness level (and buzz) for ms, up to 4 s */
+#define SEQ(led, level, buzz, ms) \
+  ((buzz) ? SEQ_BUZZ : 0) | (led) << 4 | (level), MS2TICK(ms)
+#define SEQ_END     0, 0  ///< Stop playing
+#define SEQ_LOOP(n) n, 0  ///< Go back n steps, n>0
+
+
+// PERSISTENT SETTINGS
+/** Calibration record, EE_SLOTS of them form a ring in the EEPROM */
+struct Ee_cal {
+  uint16_t base;        ///< btn_base when the record was written
+  uint16_t var;         ///< btn_var when the record was written
+  uint8_t range;        ///< btn_range when the record was written
+  uint8_t tone;         ///< buzz_tone when the record was written
+  uint8_t seq;          ///< Incremented with every record, newest is largest
+  uint8_t check;        ///< Checksum of the bytes above
+};
+/** Activity counters, totals since they were last erased (host/counters.c) */
+struct Ee_ctr {
+  uint32_t wakes;       ///< Wake-ups from power down
+  uint32_t scans;       ///< Scans of the button
+  uint32_t awake;       ///< Ticks out of power down (LEDs or buzzer running)
+  uint16_t touches;     ///< Touches detected
+  uint16_t done;        ///< Pomodoros that ran out (WORK to WAIT)
+  uint16_t aborted;     ///< Pomodoros aborted by a touch (WORK to REST)
+  uint16_t cal_fail;    ///< Calibrations that failed
+};
+/** Counts not added to the EEPROM yet, Save_ctr() does that in batches */
+struct Ctr {
+  uint16_t wakes, scans, awake;
+  uint8_t touches, done, aborted, cal_fail;
+};
+
+
+// GLOBALS
+unsigned cal;           ///< Charge time above which the button is touched
+uint16_t btn_base;      ///< Baseline charge time of the button, fixed point 8.8
+uint16_t btn_var;       ///< Variance of the charge time, fixed point 8.8
+uint8_t btn_held;       ///< Scans the button has been touched, 0 if released
+uint8_t btn_range;      ///< Charge time is counted with Timer1's clock / 2^n
+unsigned char state;    ///< Current state the timer is in
+uint8_t led_fb[6];      ///< Frame buffer: on time of each LED in timer ticks
+volatile uint16_t led_frames; ///< Number of LED frames shown so far
+uint8_t led_running;    ///< Whether the LED engine is running
+volatile uint16_t uptime; ///< Time since power-up in ticks (wraps around)
+uint16_t wdt_q8 = 256;  ///< Measured watchdog tick in ticks, fixed point 8.8
+uint16_t ev_at[EV_N];   ///< When each event is due, in ticks
+uint8_t ev_armed;       ///< Bit mask of the events that are queued
+uint8_t clk_shift;      ///< CPU clock is F_CPU>>clk_shift right now
+uint16_t vcc = VCC_NOM; ///< Supply voltage in mV, as last measured
+uint8_t led_q6 = 64;    ///< Scale of LED on times for vcc, fixed point 2.6
+uint8_t amb_q6 = 64;    ///< Part of led_q6 for the ambient light (AMBIENT)
+uint8_t buzz_tone = BUZZ_TONE; ///< Tone of the buzzer, index into tone_tab
+#if SCAN_STATS
+uint16_t scan_n[STATE_N];   ///< Touch scans done in each state
+uint16_t scan_lat[STATE_N]; ///< Sum of the worst case touch latencies in ticks
+uint8_t scan_hits[STATE_N]; ///< Touches detected in each state
+#endif
+#if COUNTERS
+struct Ctr ctr;         ///< Activity since the counters were last saved
+#endif
 
 
 // DERIVED VALUES
@@ -269,56 +422,542 @@ unsigned char state;    ///< Current state the timer is in
 #if DUTY>100 || DUTY<1
   #error "DUTY must be an integer between 1 and 100"
 #endif
-#define T_ON  ((uint32_t)(ON_TIME)*100)
-#define T_CYC (T_ON*100/(uint32_t)(DUTY))
+#define T_ON  ((ON_TIME)*100UL) ///< LED on time in us
+#define T_CYC (T_ON*100/(DUTY)) ///< Length of a PWM frame in us
 #define T_OFF (T_CYC-T_ON)
+/** ms to frames of the LED engine, rounded (for Led_wait()) */
+#define MS2FRAME(ms) (((ms)*1000UL + T_CYC/2)/T_CYC)
+
+// TIMEKEEPING (the watchdog ticks in multiples of its shortest period)
+#define TICK_MS 16      ///< Length of a tick (WDTO_15MS) in ms
+#define MS2TICK(ms) ((uint16_t)(((ms)+TICK_MS/2)/TICK_MS)) ///< ms to ticks
+#define MINUTE MS2TICK(60000UL) ///< One minute in ticks
+#define TICK_T0 ((uint16_t)(TICK_MS*(F_CPU/1000UL)/64)) ///< Tick at CK/64
+#if TICK_MS*(F_CPU/1000UL)/64 > 0xffff
+  #error "TICK_T0 does not fit 16 bits, lower TICK_MS"
+#endif
+#if 5*60000UL/TICK_MS > 0x7fff
+  #error "Events are at most 5 minutes ahead of the 16 bit uptime (int16_t)"
+#endif
+#if WORK_MIN>254 || REST_MIN>255 || WAIT_MIN>255
+  #error "Lengths of the states are counted in 8 bit minutes"
+#endif
+#if WDT_RECAL<1 || WDT_RECAL>255 || VCC_CHECK<1 || VCC_CHECK>255
+  #error "WDT_RECAL and VCC_CHECK must be 1 to 255 minutes"
+#endif
+
+// LED ENGINE (Timer1 scans one LED per slot, six slots make one T_CYC frame)
+#define LED_N 6         ///< Number of charlieplexed LEDs
+#define LED_SLOT_US ((ON_TIME)*10000UL/(DUTY)/LED_N) ///< Slot length in us
+#if DUTY*LED_N > 100
+  #error "DUTY too large for all LEDs to share one frame"
+#endif
+#if LED_SLOT_US*(F_CPU/1000000UL)/64 < 256
+  #define LED_CS  ((1 << CS12) | (1 << CS11) | (1 << CS10)) // CK/64
+  #define LED_DIV 64
+#elif LED_SLOT_US*(F_CPU/1000000UL)/256 < 256
+  #define LED_CS  ((1 << CS13) | (1 << CS10))               // CK/256
+  #define LED_DIV 256
+#elif LED_SLOT_US*(F_CPU/1000000UL)/1024 < 256
+  #define LED_CS  ((1 << CS13) | (1 << CS11) | (1 << CS10)) // CK/1024
+  #define LED_DIV 1024
+#else
+  #error "LED slot too long for Timer1, increase DUTY or lower ON_TIME"
+#endif
+#define US2TCK(us) ((uint8_t)((us)*(F_CPU/1000000UL)/LED_DIV)) ///< us to ticks
+#define TCK_SLOT US2TCK(LED_SLOT_US) ///< Length of one slot in timer ticks
+#define TCK_ON   US2TCK(T_ON)        ///< Full LED on time in timer ticks
+#if MS2FRAME(100)<1 || MS2FRAME(1000)>0xffff
+  #error "Shine_led() needs frames of 100ms at most and Led_wait() 16 bits"
+#endif
+/**
+ * Most CPU cycles from a compare match to the new OCR1A. Counted by hand
+ * from the C, like the budgets in host/budgets.txt, and not measured yet:
+ * about 70 for the interrupt itself, response and the dark half of a slot
+ * included, and up to about 120 for a watchdog interrupt that may be running
+ * in front of it, rounded up. TCK_MIN and with it TLM_TCK and the shortest
+ * on time of the gamma table rest on it. Check with "make bench" and raise
+ * it if TIMER1_COMPA->OCR1A plus WDT_vect come out higher.
+ */
+#define LED_ISR_CYCLES 200
+/** Shortest on or off phase the ISR can keep up with, at the slow clock too */
+#define TCK_MIN  ((LED_ISR_CYCLES*(1 << CLK_SLOW)+LED_DIV-1)/LED_DIV < 2 ? 2 : \
+                  (LED_ISR_CYCLES*(1 << CLK_SLOW)+LED_DIV-1)/LED_DIV)
+#if VCC_NOM<=LED_VF || VCC_NOM>5500
+  #error "VCC_NOM must be between LED_VF and 5500 mV"
+#endif
+#if CLK_SLOW<0 || CLK_SLOW>3 || (1 << CLK_SLOW)>=LED_DIV
+  #error "CLK_SLOW must be 0 to 3 and leave Timer1 a prescaler for the LEDs"
+#endif
+#define LED_MASK ((1 << PB1) | (1 << PB3) | (1 << PB4)) ///< Charlieplexed pins
+/** Timer1 ticks of one Get_light() count (128us, CK/1024 at the full clock) */
+#define AMB_TCK_Q (1024/LED_DIV)
+/** Longest discharge Get_light() waits for, 255 counts, in Timer1 ticks */
+#define AMB_TCK (255U*AMB_TCK_Q)
+#if AMBIENT && (AMB_LED<0 || AMB_LED>=LED_N || AMB_BRIGHT<1 || \
+                AMB_BRIGHT>127 || AMB_MIN_Q6<1 || AMB_MIN_Q6>64 || \
+                AMB_CHECK<1 || AMB_CHECK>255)
+  #error "AMB_LED, AMB_BRIGHT, AMB_MIN_Q6 or AMB_CHECK out of range"
+#endif
+#if AMBIENT && AMB_LED>=4       // LED 5 is the red one, 4 its twin
+  #error "AMB_LED and its twin have to be blue LEDs, see Get_light()"
+#endif
+/** DDRB and PORTB bits that light the LED between pins hi (+) and lo (-) */
+#define LED_PAT(hi, lo) { (1 << (hi)) | (1 << (lo)), 1 << (hi) }
+
+// DEEP SLEEP (pins are parked driven low, DIDR0 keeps only the pad's input)
+/** All pins but RESET (the telemetry on PB0 idles low as well) */
+#define PARK_MASK (LED_MASK | (1 << PB0) | (1 << PB2))
+/** Pins that are never read digitally */
+#define DIDR_AWAKE (LED_MASK | (1 << PB0) | (SENSE_ADC ? (1 << PB2) : 0))
+
+// BRIGHTNESS (perceptually even levels, mapped to on times by a gamma table)
+#define BRIGHT_N   16   ///< Number of brightness levels, 0 is off
+#define BRIGHT_MAX (BRIGHT_N-1) ///< Full brightness
+/** Level i to the gamma, blended from i^2 (GAMMA_Q8 512) and i^3 (768) */
+#define GAMMA_X(i) ((uint32_t)(i)*(i)*((i)*(GAMMA_Q8-512UL) + \
+                    BRIGHT_MAX*(768UL-GAMMA_Q8)))
+/** On time of brightness level i in timer ticks, at least TCK_MIN if lit */
+#define GAMMA(i) ((i) ? (uint8_t)(TCK_MIN + (TCK_ON-TCK_MIN)*GAMMA_X(i) / \
+                  (256UL*BRIGHT_MAX*BRIGHT_MAX*BRIGHT_MAX)) : 0)
+#if GAMMA_Q8<512 || GAMMA_Q8>768
+  #error "GAMMA_Q8 must be between 512 (gamma 2) and 768 (gamma 3)"
+#endif
+#if BRIGHT_N!=16
+  #error "The gamma table in To-mate-Oh.c has 16 entries"
+#endif
+/** Ticks per step of the fade of the leading LED of WORK */
+#define FADE_STEP ((uint16_t)(5UL*MINUTE/BRIGHT_MAX))
+#if GLANCE && (GLANCE_EVERY<1 || GLANCE_EVERY>300 || GLANCE_SHOW<1 || \
+               GLANCE_SHOW>300 || GLANCE_MS<TICK_MS)
+  #error "GLANCE_EVERY and GLANCE_SHOW must be 1 to 300 s, GLANCE_MS a tick"
+#endif
+
+// BUZZER (Timer0 at CK/8 in CTC mode makes the tones on OC0A = PB0)
+#define BUZZ_N 12       ///< Tones in tone_tab, semitones from 2794 Hz (F7)
+/** Timer0 compares in half a period of a tone of hz, 50% duty (toggle OC0A) */
+#define TONE_HALF(hz) ((F_CPU/16 + (hz)/2)/(hz))
+/** Timer0 compares a pulse of BUZZ_DUTY lasts, and the rest of the period */
+#define TONE_ON(hz)  ((2*TONE_HALF(hz)*BUZZ_DUTY + 50)/100)
+#define TONE_OFF(hz) (2*TONE_HALF(hz) - TONE_ON(hz))
+/** Entry of tone_tab: OCR0A for each half (toggle) or the pulse and the rest */
+#define TONE(hz) { BUZZ_DUTY<50 ? TONE_ON(hz)-1 : TONE_HALF(hz)-1, \
+                   BUZZ_DUTY<50 ? TONE_OFF(hz)-1 : TONE_HALF(hz)-1 }
+#if BUZZ_DUTY<30 || BUZZ_DUTY>50
+  #error "BUZZ_DUTY must be 30 to 50, Timer0 has 8 bits for the pause"
+#endif
+#if TONE_OFF(2794)>256 || TONE_HALF(2794)>256 || TONE_ON(5274)<8
+  #error "The tones do not fit Timer0 at CK/8, check F_CPU"
+#endif
+#if BUZZ_TONE<0 || BUZZ_TONE>=BUZZ_N || BUZZ_N!=2*LED_N
+  #error "BUZZ_TONE must index tone_tab, which has two tones per LED"
+#endif
+#if BUZZ_TUNE && (TUNE_HOLD<1 || TUNE_HOLD*8>=BTN_STUCK)
+  #error "TUNE_HOLD must be 1 s or more and end before BTN_STUCK 120ms scans"
+#endif
+
+// TELEMETRY (records of TLM_LEN bytes: type, two values MSB first, checksum)
+#define TLM_SAMPLE 0x10 ///< + Scan_button() result: charge time, btn_base
+#define TLM_CAL    0x20 ///< Calibration: cal, btn_var
+#define TLM_STATE  0x30 ///< State entered: state, uptime
+#define TLM_LEN    6    ///< Bytes per record
+/** Timer0 compare value (CTC at CK/8) for a bit time */
+#define TLM_OCR ((F_CPU/8 + TLM_BAUD/2)/TLM_BAUD - 1)
+#if TELEMETRY && (TLM_OCR<8 || TLM_OCR>255)
+  #error "TLM_BAUD is out of reach of Timer0 at CK/8"
+#endif
+/** Timer1 ticks a byte keeps interrupts off: 10 bit times, plus one */
+#define TLM_TCK ((10*8*(TLM_OCR+1) + LED_DIV-1)/LED_DIV + 1)
+#if TELEMETRY && TLM_TCK >= LED_SLOT_US*(F_CPU/1000000UL)/LED_DIV/2
+  #error "A telemetry byte does not fit half an LED slot, raise TLM_BAUD"
+#endif
 
 // FUNCTION PROTOTYPES
 
-/**Intializes the watchdog timer and sets the microcontroller's pins properly.*/
+/**
+ * Restart the watchdog timer with the given timeout (WDTO_*) in interrupt
+ * mode. Every interrupt advances uptime by the timeout in ticks.
+ */
 void Config_wdt(uint8_t);
 
 /**
  * Put microcontroller into sleep mode to conserve power.
  *
+ * Sleeps for the given number of watchdog timeouts. The watchdog is only
+ * reconfigured if the timeout changed, so uptime stays accurate. The sleep
+ * mode is the deepest one the running peripherals allow: idle while the LED
+ * engine or the buzzer need their timer, power down otherwise. Interrupts of
+ * the LED engine put the controller right back to sleep.
+ *
  * Although the ATTiny25 supports it on paper, using timeouts over two seconds
  * leads to strange behavior in test cases. So use "WDTO_2S" as absolute maximum
  * timeout!
  */
 void Sleep_now(uint8_t, uint8_t);
 
-/** Access individual LEDs through charlieplexing. */
+/**
+ * Put all pins but RESET into their state of least leakage before power down.
+ *
+ * They are driven low: the LEDs see no voltage, the pad is discharged and the
+ * buzzer's transistor is off. Floating inputs would pick up noise and make
+ * their input buffers draw current, so DIDR0 turns the buffers off, too. The
+ * indicator and sensing code set the pins up again when they need them.
+ * Only with DEEP_SLEEP, which also turns off the analog comparator and
+ * disables the brown-out detector while sleeping in power down (BODS).
+ */
+void Park_pins();
+
+/**
+ * Calibrate the watchdog timer.
+ *
+ * The watchdog's oscillator is off by up to ten percent and drifts with
+ * temperature and supply voltage. This measures one WDTO_15MS period against
+ * the CPU clock with Timer0 (Timer1 belongs to the LED engine) and stores it
+ * in wdt_q8, which every watchdog interrupt then adds to uptime. Takes up to
+ * two watchdog periods and is skipped while the buzzer uses Timer0.
+ */
+void Cal_wdt();
+
+/**
+ * Measure the supply voltage.
+ *
+ * The ADC converts the internal 1.1V bandgap against VCC as reference, the
+ * lower VCC the larger the result. Takes about 1.3ms at full speed, the ADC is
+ * off again afterwards. Also sets led_q6: the LEDs have no resistor, so their
+ * current rises with the voltage left after their forward voltage (LED_VF).
+ * Their on time is scaled against it, shorter on a fresh battery and up to
+ * three times ON_TIME on an empty one, to keep the brightness of VCC_NOM.
+ *
+ * \return Supply voltage in mV (also in vcc)
+ */
+uint16_t Get_vcc();
+
+/**
+ * Measure the ambient light with an LED and dim the LEDs in the dark.
+ *
+ * AMB_LED is reverse biased, cathode high and anode low, which charges its
+ * junction capacity. Then the cathode floats and the photo current discharges
+ * it: the darker, the longer it reads high. Timer1 counts that time in 128us
+ * steps, 255 when it takes longer than about 33ms. A running LED engine keeps
+ * its time meanwhile but leaves the pins alone, so the sample is taken in the
+ * dark of the display. It is cut off after one frame then, which takes one
+ * on phase off every LED at most and reads 255 beyond about 10ms (78 counts
+ * at the default T_CYC): the darkest step of the dimming starts earlier while
+ * the LEDs are lit. It runs at the full clock.
+ *
+ * The LED between the same pins the other way round, its twin (AMB_LED^1), is
+ * forward biased all along. It flashes for the 10us the junction charges and
+ * then drains the cathode quickly down to its own knee voltage, slowly below.
+ * For a blue twin (VLMB1300, knee about 2.5V) that stays above the pin's input
+ * threshold, so only the part of the swing the photo current discharges is
+ * counted. Its leakage below the knee sets how long the darkest reading gets,
+ * which the 255 counts cap anyway. The red LED (5) would pull the cathode
+ * under the threshold at once and read bright always, so neither it nor its
+ * twin (4) may sense the light. The default pair 2 and 3 are both blue.
+ *
+ * Up to AMB_BRIGHT counts the LEDs are at full brightness. Every doubling of
+ * the time beyond takes a quarter off amb_q6, down to AMB_MIN_Q6, and led_q6
+ * is scaled with it. With AMBIENT, at start-up, when a pomodoro starts and
+ * every AMB_CHECK minutes of a session.
+ *
+ * \return Discharge time in 128us counts
+ */
+uint8_t Get_light();
+
+/**
+ * Set the system clock prescaler to F_CPU>>shift (CLKPR).
+ *
+ * Active and idle current scale with the clock, so the CPU runs at F_CPU only
+ * to measure the button and the watchdog and to play the buzzer. A running
+ * Timer1 gets a smaller prescaler, so the LED engine keeps its tick. Timer0
+ * and _delay_ms() and _delay_us() count F_CPU cycles, so they are only used
+ * at full speed.
+ */
+void Clock_set(uint8_t shift);
+
+/** Read uptime atomically. */
+uint16_t Uptime();
+
+/** Queue an event to be due after the given delay in ticks. */
+void Schedule(uint8_t ev, uint16_t delay);
+
+/** Queue an event one period after it was last due (does not drift). */
+void Repeat(uint8_t ev, uint16_t period);
+
+/** Run the handlers of all events that are due. */
+void Run_events();
+
+/**
+ * Find the longest watchdog timeout (WDTO_*) that does not sleep past the next
+ * queued event.
+ */
+uint8_t Next_timeout();
+
+/** Switch to a state, set up its display and queue its events. */
+void Enter(uint8_t s);
+
+/** Invokes the respective actions, when the button was pressed. */
+void On_touch();
+
+/**
+ * Resume scanning the button after a guard time in ticks, fast at first.
+ */
+void Scan_after(uint16_t guard);
+
+/**
+ * Handler of EV_SCAN: check the button and queue the next scan.
+ *
+ * Scans every SCAN_FAST ticks while the button is held or almost touched. The
+ * time between scans doubles after every SCAN_BACKOFF quiet scans, up to
+ * SCAN_SLOW when idle or SCAN_BUSY during a session. With SCAN_STATS, counts
+ * the scans and touches of every state and adds up the worst case latency of
+ * each touch (time since the last scan).
+ */
+void On_scan();
+
+/** Handler of EV_MINUTE: count down the current state and update the LEDs. */
+void On_minute();
+
+/**
+ * Handler of EV_BLINK: blink the minute code (WORK) or step the animation of
+ * the state (SEQ_ANIM).
+ */
+void On_blink();
+
+/**
+ * Handler of the event of a sequence channel: end the step it plays and
+ * start the next one.
+ */
+void On_seq(uint8_t ch);
+
+/**
+ * Play a sequence on a channel, replacing what it played.
+ *
+ * Sequences are tables of two byte steps in flash, written with SEQ(),
+ * SEQ_END and SEQ_LOOP(). Each step lights one LED at a brightness level,
+ * optionally buzzes, and lasts a number of ticks. The scheduler times the
+ * steps, so the CPU sleeps in between.
+ */
+void Seq_play(uint8_t ch, const uint8_t *seq);
+
+/** End the step a channel plays: LED dark, buzzer off, event dequeued. */
+void Seq_end(uint8_t ch);
+
+/** Start the step at pc (following SEQ_LOOP, stopping at SEQ_END). */
+void Seq_step(uint8_t ch, const uint8_t *pc);
+
+/**
+ * Handler of EV_FADE: dim the leading LED of the WORK display by one level,
+ * so it fades out smoothly over the five minutes it stands for.
+ */
+void On_fade();
+
+/**
+ * Show the WORK progress bar up to the given leading LED. With GLANCE only
+ * while the progress is looked at after a touch.
+ */
+void Show_work(signed char lead);
+
+/**
+ * Handler of EV_GLANCE: with GLANCE, WORK stays dark, so the controller
+ * sleeps in power down instead of idling for the LED engine. Every
+ * GLANCE_EVERY seconds a flash of GLANCE_MS phases shows the slices left, then
+ * blinks the leading LED once per minute passed in its slice. A touch shows
+ * the full display (fading leading LED, minute blinks) for GLANCE_SHOW
+ * seconds, and only a touch while it shows aborts the pomodoro.
+ */
+void On_glance();
+
+/** With GLANCE, show the full WORK display for GLANCE_SHOW seconds. */
+void Glance_show();
+
+/**
+ * Access individual LEDs through charlieplexing.
+ *
+ * Looks up the DDRB and PORTB bits of the LED in a table in flash. Any led
+ * out of 0 to LED_N-1 turns all LEDs off.
+ */
 void Set_leds(int led);
 
-/** Poor PWM for dimming an led for a duration given in multiples of 10ms. */
-void Shine_led(int led, uint32_t duration);
+/**
+ * Start the LED engine.
+ *
+ * Timer1 runs freely and its compare match A interrupt steps through the
+ * charlieplexed LEDs. Every LED gets a slot of LED_SLOT_US and is lit at the
+ * end of the slot for as many timer ticks as its entry in led_fb says. The CPU
+ * can sleep in idle mode in between.
+ */
+void Led_start();
+
+/** Stop the LED engine and turn all LEDs off. */
+void Led_stop();
+
+/** Set all frame buffer entries to zero (all LEDs dark). */
+void Led_clear();
+
+/** Set the on time of one LED in the frame buffer in timer ticks. */
+void Led_set(uint8_t led, uint8_t ticks);
 
-/** Start the piezo buzzer. */
+/**
+ * Set the brightness of one LED in the frame buffer.
+ *
+ * The level (0 to BRIGHT_MAX) is mapped to an on time through a gamma table
+ * computed at compile time, so equal steps look equally large. The on time
+ * is scaled with led_q6 for the supply voltage and the ambient light.
+ */
+void Led_level(uint8_t led, uint8_t level);
+
+/** Start or stop the LED engine depending on whether any LED is lit. */
+void Led_update();
+
+/** Sleep in idle mode until the LED engine has shown the given frames. */
+void Led_wait(uint16_t frames);
+
+/** Light an led at full brightness for some frames, see MS2FRAME(). */
+void Shine_led(int led, uint16_t frames);
+
+/**
+ * Start the piezo buzzer with the tone buzz_tone.
+ *
+ * The tones come from a table computed at compile time. At BUZZ_DUTY 50,
+ * Timer0 toggles OC0A in hardware. Below, PB0 is only driven for a pulse of
+ * BUZZ_DUTY percent of every period, which draws less from the battery but
+ * gets loud only close to the resonance of the piezo, see Tune_buzz(). The
+ * compare match interrupt of Timer0 then shapes the pulses.
+ */
 void Start_buzz();
 
 /** Stop the piezo buzzer. */
 void Stop_buzz();
 
-/** Plays the indicator melody. */
+/**
+ * Find the loudest tone of the buzzer by ear and keep it in the EEPROM.
+ *
+ * The board has no way to sense the resonance of the piezo, so the tones of
+ * tone_tab play one after the other for TUNE_MS, a LED for every two (the
+ * brighter one is the lower tone). A touch right after the loudest one
+ * selects it. It is saved with the calibration of the button and confirmed
+ * with two beeps. Without a touch in TUNE_ROUNDS sweeps, the tone stays.
+ *
+ * Started by touching the pad while the LEDs circle after power-up
+ * (BUZZ_TUNE) and holding it for TUNE_HOLD seconds, until a beep says to let
+ * go. A shorter touch is ignored, so brushing the board does not start a
+ * sweep. Neither does a pad that reads touched until BTN_STUCK takes it for
+ * the baseline: only a release counts.
+ */
+void Tune_buzz();
+
+/** Starts the indicator melody, On_seq() plays it in the background. */
 void Play_sound();
 
 /**
  * Measure the time to charge the button. Takes the sum of several charge
  * cycles to be more sensitive.
  *
- * \return Time it took to charge the button
+ * Timer1 counts the charge time with its clock divided by 2^btn_range, which
+ * Get_cal() picks so that the untouched button reads below 128. A touch that
+ * overflows the counter reads 255. With SENSE_PLL, Timer1's clock is the
+ * 64MHz PLL, switched on just for the measurement (about 100us to lock).
+ * Small pads then read 8 times larger, but the loop polling the pin still
+ * only looks every 3 CPU cycles, so the steps of the reading do not shrink.
+ *
+ * With SENSE_ADC, measures by charge sharing instead: the ADC's sample and
+ * hold capacitor is charged to VCC through ADC0 (the RESET pin, pulled up),
+ * the pad is discharged and then connected to it through ADC1. The less
+ * voltage is left, the larger the pad's capacity. The result does not depend
+ * on VCC or the pull-up, does not saturate and takes one conversion (about
+ * 30us at full speed) instead of polling a pin.
+ *
+ * \return Time it took to charge the button (or 255 minus the voltage left
+ *         in 1/256 of VCC), larger when touched
  */
 unsigned Get_time();
 
 /**
  * Calibrate charge time of the button.
  *
- * This time is later used to detect a button press.
+ * Picks btn_range, then initializes baseline and noise variance from a few
+ * measurements.
+ *
+ * \return Charge time above which the button counts as touched
  */
 unsigned Get_cal();
 
-/** Invokes the respective actions, when the button was pressed. */
-void Handle_button_press();
+/**
+ * Touch threshold for the current baseline and noise: BTN_SIGMA standard
+ * deviations above the baseline, but at least BTN_THRESHOLD.
+ */
+unsigned Btn_threshold();
+
+/**
+ * Feed a measurement of the untouched button to the slow IIR filters that
+ * track its baseline and noise variance, then update cal. Temperature,
+ * humidity and a sagging battery shift the charge time, this follows them.
+ */
+void Track_button(unsigned x);
+
+/**
+ * Load the newest calibration from the EEPROM ring.
+ *
+ * The cached baseline is checked against a few quick measurements. If the
+ * button charges much faster than cached, something changed and it has to be
+ * calibrated again. So it is if every one of them is above the threshold:
+ * a finger and a baseline that drifted up look the same, and taking the drift
+ * for a touch would leave the button pressed until BTN_STUCK.
+ *
+ * \return 1 if the cached calibration is in use, 0 if there is none or it
+ *         does not fit
+ */
+uint8_t Load_cal();
+
+/**
+ * Write baseline and noise of the button to the next slot of the EEPROM ring.
+ * Spreading the writes over EE_SLOTS slots spreads the wear of the cells.
+ * Called after a calibration and at the end of every session.
+ */
+void Save_cal();
+
+/**
+ * Add the activity counted in ctr to the totals in the EEPROM and clear it.
+ *
+ * Called at the end of every session, after a failed calibration and before
+ * a count in RAM runs over, so the EEPROM cells see a write every few minutes
+ * at most. Only built with COUNTERS. "make counters" reads the totals.
+ */
+void Save_ctr();
+
+/**
+ * Scan the button.
+ *
+ * A touch has to exceed cal and be confirmed by BTN_DEBOUNCE more samples. It
+ * is only released again once the charge time falls below half the threshold
+ * (hysteresis). A touch that lasts BTN_STUCK scans becomes the new baseline.
+ * All other scans go to Track_button().
+ *
+ * \return BTN_PRESS if the button was just touched, BTN_NEAR while it is held
+ *         or the charge time is above half the threshold, BTN_QUIET otherwise
+ */
+uint8_t Scan_button();
+
+/**
+ * Send a telemetry record of a type (TLM_SAMPLE, ...) and two values out on
+ * PB0, only built with TELEMETRY.
+ *
+ * Every byte is a software UART frame (TLM_BAUD, 8N1), bit-banged at full
+ * clock with interrupts off. Timer0 times the bits, so the baud rate does not
+ * depend on the loop. While the LED engine runs, every byte waits for a gap
+ * of TLM_TCK ticks before its next compare match, so the engine is never held
+ * up. One of the two phases of a slot always is that long. A record costs
+ * TLM_LEN*10 bit times (about 1.6ms at 38400 baud) plus up to half a slot of
+ * waiting per byte. Nothing is sent while the buzzer owns PB0 and Timer0.
+ *
+ * The levels are inverted (RS-232 polarity) and the line idles low, in power
+ * down too: PB0 also drives the buzzer's transistor, a line idling high would
+ * keep the coil across the battery. The serial adapter has to invert its RX
+ * input (FTDI and CP210x chips can be configured to) or get the line through
+ * an inverter. host/telemetry.c turns the stream into CSV.
+ */
+void Tlm_send(uint8_t type, uint16_t a, uint16_t b);
 
 #endif
 
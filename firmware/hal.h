@@ -0,0 +1,40 @@
+/* Indent: space, Tabsize: 4, Encoding: UTF-8, Language: C/Eng, Breaks: linux */
+/**
+ * \file hal.h
+ *
+ * Hardware abstraction layer of To-mate-Oh.
+ *
+ * The firmware only reaches the hardware through the names defined here: the
+ * I/O registers and their bits, the delay, sleep, watchdog, interrupt, flash
+ * and EEPROM primitives of avr-libc and the few helpers below. On the micro
+ * controller they are exactly what avr-libc provides. When HOST is defined,
+ * they come from ./host/avr-mock.h instead, a mock register file with a
+ * virtual clock that lets the firmware run (and be measured) on a Linux box.
+ *
+ * \date 17 Oct 2026
+ * \author <a href="mailto:con-f-use@gmx.net">con-f-use</a>
+ * \copyright
+ * This file is part of To-mate-Oh. Copyright © 2026 con-f-use. Use permitted
+ * under GNU General Public License v3.0.
+ */
+
+#ifndef ___TomateOh_hal_h___
+#define ___TomateOh_hal_h___
+
+#ifdef HOST
+  #include "host/avr-mock.h"  // mock register file and virtual clock
+#else
+  #include <avr/io.h>         // standard input/output for handy macros
+  #include <util/delay.h>     // for delay functions
+  #include <avr/power.h>      // handy power down commands
+  #include <avr/wdt.h>        // easy control of the watchdog (wakes the device)
+  #include <avr/sleep.h>      // sleep mode for lower power consumption
+  #include <avr/interrupt.h>  // for sei()
+  #include <avr/pgmspace.h>   // constant tables in flash
+  #include <avr/eeprom.h>     // settings that survive a power cycle
+
+  /** Clear timer interrupt flags, writing a one to a flag clears it. */
+  #define Clear_tifr(flags) (TIFR = (flags))
+#endif
+
+#endif
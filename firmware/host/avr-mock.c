@@ -0,0 +1,832 @@
+/* Indent: space, Tabsize: 4, Encoding: UTF-8, Language: C/Eng, Breaks: linux */
+/**
+ * \file avr-mock.c
+ *
+ * Virtual clock, peripherals and test driver behind ./host/avr-mock.h.
+ *
+ * Runs the firmware (renamed to Firmware_main() by the Makefile) for a given
+ * stretch of virtual time with scripted touches of the pad and prints where
+ * the time went: active, idle and power-down cycles, per firmware state, LED
+ * and buzzer on time (with the buzzer's tone and duty, every new tone is also
+ * traced by its OCR0A), and the average CPU clock while active and idle. It
+ * also measures how long the firmware takes to respond to touches and prints
+ * the scan counters of the firmware (SCAN_STATS). From the currents of the
+ * datasheet, it estimates the charge drawn in every state and per pomodoro and
+ * how many days a CR2032 lasts at the simulated use.
+ *
+ *     ./To-mate-Oh-host [-t sec] [-b cyc] [-d cyc] [-n cyc] [-w %] [-v V]
+ *                       [-a ms] [-q] [-e file] [-i name=uA] [-p n] [-u file]
+ *                       [touch[:length]] ...
+ *
+ * -t is the simulated time in seconds (default 3600), -b the charge time of
+ * the untouched pad in CPU cycles (20), -d what a finger adds to it (20), -n
+ * the peak noise on it (1), -w the error of the watchdog oscillator in percent
+ * (0), -v the supply voltage (3.0), -a how long a reverse biased LED takes
+ * to discharge in the ambient light in ms (0.5, an office; dark is 30 and
+ * more, see AMBIENT) and -q suppresses the trace of state changes. -e names
+ * a file that holds the EEPROM across runs (a power cycle), it is read at the
+ * start if it exists and written at the end. Every touch is given as the
+ * second it starts at and optionally how many seconds it lasts (0.3). -i
+ * overrides one of the currents of the energy model (see amp_name, "battery"
+ * is the capacity in uAh) and -p n scripts a day of use: n pomodoros with
+ * their rests, idle for the rest of the day (-t 86400). -u writes what an
+ * inverted UART at UART_BAUD receives on PB0 to a file (TELEMETRY).
+ *
+ * \date 17 Oct 2026
+ * \author <a href="mailto:con-f-use@gmx.net">con-f-use</a>
+ * \copyright
+ * This file is part of To-mate-Oh. Copyright © 2026 con-f-use. Use permitted
+ * under GNU General Public License v3.0.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "avr-mock.h"
+
+#define I_BIT       0x80    // global interrupt enable in SREG
+#define ISR_CYCLES  48      // response, vector, prologue, epilogue and reti
+#define POLL_CYCLES 3       // one turn of a loop polling PINB
+#define MAX_TOUCH   64
+#define EE_SIZE     128     // bytes of EEPROM of the ATTiny25
+#define EE_WRITE_S  3.4e-3  // erase and write of one EEPROM byte
+#define PAD_PF      3.9     // capacity of the pad per cycle of charge time
+#define SH_PF       14.0    // sample and hold capacitor of the ADC
+#define PLL_LOCK    100e-6  // lock time of the PLL after PLLE is set
+#define LED_VF      1.9     // forward voltage of the LEDs
+#define LED_LINES   0x1a    // PB1, PB3 and PB4 drive the charlieplexed LEDs
+#define UART_BAUD   38400   // -u: baud rate of the telemetry on PB0 (TLM_BAUD)
+#define DAY_START   600     // -p: first pomodoro of the day starts (seconds)
+#define DAY_WAIT    20      // -p: time in WAIT before the rest is started
+#define DAY_GAP     60      // -p: idle time between rest and next pomodoro
+
+enum { ACTIVE, IDLE, PWR_DOWN, MODES };
+static const char *mode_name[MODES] = { "active", "idle", "power-down" };
+
+struct Mock_regs mock;
+extern unsigned char state;     // firmware state, traced and accounted
+extern uint16_t scan_n[] __attribute__((weak));     // absent without
+extern uint16_t scan_lat[] __attribute__((weak));   // SCAN_STATS
+extern uint8_t scan_hits[] __attribute__((weak));
+int Firmware_main(void);
+
+// VIRTUAL CLOCK AND PERIPHERAL STATE
+static uint64_t now;            // virtual time in CPU cycles
+static uint64_t end_at;         // when the simulation stops
+static uint64_t t0_at;          // cycle Timer0 was last brought up to date
+static uint64_t t1_at;          // Timer1 brought up to date, in 1/8 cycles
+static uint64_t pll_at;         // cycle the PLL was enabled
+static uint64_t wdt_at;         // cycle the watchdog counter was last reset
+static uint64_t adc_at;         // cycle the ADC conversion started
+static uint64_t charge_at;      // cycle the pad started charging
+static unsigned charge_len;     // cycles the pad needs to charge this time
+static double   sh_v;           // voltage on the ADC's sample and hold
+static double   pad_v;          // voltage on the pad
+static uint8_t  charging;       // pad pulled up as an input
+static uint8_t  sleep_as;       // sleep mode selected by the firmware
+static uint8_t  frozen;         // in power-down, Timer1 has no clock
+static uint8_t  traced = 0xff;  // last state printed
+static uint8_t  clk_shift;      // CPU clock is F_CPU>>clk_shift (CLKPR)
+static uint64_t uart_at;        // PB0 had its level since this cycle
+static uint64_t uart_start;     // start bit of the byte being received
+static int      uart_k = -1;    // bit of that byte, -1 waiting for a start bit
+static uint8_t  uart_byte;
+static uint64_t line_at[8];     // LED line was last high (driven or pulled up)
+static uint8_t  line_held;      // LED lines that float holding their charge
+
+// SETTINGS
+static double   wdt_hz = 128000;
+static double   vcc = 3.0;
+static double   amb_ms = 0.5;   // -a: a floating LED line discharges (light)
+static unsigned pad_base = 20, pad_touch = 20, pad_noise = 1;
+static double   touch_at[MAX_TOUCH], touch_len[MAX_TOUCH];
+static int      touches, quiet;
+static int      answered;       // touches that already got a response
+static const char *ee_file;
+static FILE     *uart_f;        // -u: bytes received on PB0
+static uint8_t  eeprom[EE_SIZE];
+extern uint8_t  __start_mock_eeprom[];  // EEMEM variables of the firmware
+
+// CURRENT DRAW in uA, typical figures of the ATTiny25 datasheet at 3V, -i
+enum { I_ACTIVE, I_IDLE, I_PWR_DOWN, I_WDT, I_BOD, I_FLOAT, I_ADC, I_PLL,
+       I_LED, I_BUZZER, I_BATTERY, I_N };
+static const char *amp_name[I_N] = { "active", "idle", "pwrdown", "wdt",
+  "bod", "float", "adc", "pll", "led", "buzzer", "battery" };
+static double amp[I_N] = {
+  350,      // active, per MHz of CPU clock
+  90,       // idle, per MHz
+  0.15,     // power down, everything off
+  4,        // watchdog running in power down
+  0,        // BOD in power down, 20 if the fuses enable it (0xdf does not)
+  20,       // floating input buffers in power down
+  200,      // ADC enabled
+  5000,     // PLL running
+  8000,     // LED lit, through the pins' resistance at 3V
+  1000,     // piezo buzzer driven at half duty, scales with the duty
+  225000    // capacity of the battery in uAh (CR2032)
+};
+
+// STATISTICS
+static uint64_t in_mode[MODES];
+static uint64_t bod_off;            // power down with the BOD disabled
+static uint64_t floating;           // power down with floating input buffers
+static uint64_t pll_on;             // time the PLL ran
+static uint64_t cpu_cycles[MODES];  // cycles the (prescaled) CPU clock made
+static uint64_t in_state[256][MODES];
+static uint64_t led_on[6];
+static double   charge[256];        // uAs drawn in each state
+static int      pomodoros;          // times WORK was entered
+static uint64_t buzz_on;
+static double   buzz_high;          // cycles PB0 drove the buzzer
+static uint64_t buzz_edges;         // toggles of PB0 by Timer0 or its ISR
+static int      buzz_traced = -1;   // OCR0A of the last tone printed
+static int      buzz_was;           // buzzer sounded at the last Advance()
+static uint64_t io_count;
+static unsigned ee_writes;
+static unsigned t1_missed;          // OCR1A written after TCNT1 passed it
+static unsigned uart_bytes, uart_errors;
+static double   lat_sum, lat_max;
+static int      lat_n;
+
+static void Advance(uint64_t cycles, int mode);
+
+static double Sec(uint64_t cycles) { return cycles/(double)F_CPU; }
+
+// Length of CPU cycles at the current prescaler, in cycles of F_CPU
+static uint64_t Cpu(uint64_t cycles) { return cycles << clk_shift; }
+
+// Charge drawn per state and per pomodoro, and how long the battery lasts
+static void Report_energy(void) {
+  double total = 0, session = 0, ua;
+  int i;
+
+  for( i=0; i<256; ++i ) {
+    total += charge[i];
+    if( i ) session += charge[i];
+  }
+  ua = total/Sec(now);
+  printf("  energy     %.3f uAh, average %.3f uA at %.2f V\n", total/3600,
+         ua, vcc);
+  for( i=0; i<256; ++i )
+    if( charge[i] ) printf("  state %3d  %.3f uAh\n", i, charge[i]/3600);
+  if( pomodoros )
+    printf("  pomodoro   %.3f uAh each, %.1f a day\n",
+           session/3600/pomodoros, pomodoros*86400/Sec(now));
+  printf("  battery    %.0f mAh last %.0f days of this\n", amp[I_BATTERY]/1e3,
+         amp[I_BATTERY]/ua/24);
+}
+
+static void Report(void) {
+  int i, j;
+
+  printf("simulated %.3f s, %llu register accesses\n", Sec(now),
+         (unsigned long long)io_count);
+  for( i=0; i<MODES; ++i ) {
+    printf("  %-10s %12.6f s", mode_name[i], Sec(in_mode[i]));
+    if( i!=PWR_DOWN && in_mode[i] )
+      printf(" at %.3f MHz", F_CPU/1e6*cpu_cycles[i]/in_mode[i]);
+    if( i==PWR_DOWN )
+      printf(", BOD off %.3f s, floating inputs %.3f s", Sec(bod_off),
+             Sec(floating));
+    printf("\n");
+  }
+  for( i=0; i<256; ++i ) {
+    if( !in_state[i][ACTIVE] && !in_state[i][IDLE] ) continue;
+    printf("  state %3d ", i);
+    for( j=0; j<MODES; ++j )
+      printf(" %s %.6f s", mode_name[j], Sec(in_state[i][j]));
+    printf("\n");
+  }
+  printf("  led on    ");
+  for( i=0; i<6; ++i ) printf(" %d: %.3f s", i, Sec(led_on[i]));
+  printf("\n  lines      PB1: %.3f s PB3: %.3f s PB4: %.3f s (sourcing)",
+         Sec(led_on[1]+led_on[2]), Sec(led_on[3]+led_on[4]),
+         Sec(led_on[0]+led_on[5]));
+  printf("\n  buzzer on  %.3f s", Sec(buzz_on));
+  if( buzz_on )
+    printf(", %.0f Hz, duty %.0f%%", buzz_edges/2/Sec(buzz_on),
+           100*buzz_high/buzz_on);
+  printf("\n");
+  if( pll_on ) printf("  pll on     %.6f s\n", Sec(pll_on));
+  printf("  eeprom     %u bytes written\n", ee_writes);
+  if( t1_missed ) printf("  led engine %u compares missed\n", t1_missed);
+  if( uart_f )
+    printf("  telemetry  %u bytes received, %u framing errors\n", uart_bytes,
+           uart_errors);
+  Report_energy();
+  if( lat_n )
+    printf("  latency    %d touches, mean %.3f s, max %.3f s\n", lat_n,
+           lat_sum/lat_n, lat_max);
+  if( !scan_n ) return;
+  for( i=0; i<5; ++i ) {     // STATE_N
+    if( !scan_n[i] ) continue;
+    printf("  state %3d  %u scans, %u touches", i, scan_n[i], scan_hits[i]);
+    if( scan_hits[i] )
+      printf(", worst case latency %.3f s", scan_lat[i]*16e-3/scan_hits[i]);
+    printf("\n");
+  }
+}
+
+static void Fail(const char *why) {
+  printf("%.6f s: %s\n", Sec(now), why);
+  Report();
+  exit(1);
+}
+
+//###################################################################### Pins
+
+static int Lit_led(void) {
+  // (high pin, low pin) of every LED, in the order of Set_leds()
+  static const uint8_t pins[6][2] = {{4,1},{1,4},{1,3},{3,1},{3,4},{4,3}};
+  int i;
+  for( i=0; i<6; ++i ) {
+    uint8_t hi = 1 << pins[i][0], lo = 1 << pins[i][1];
+    if( (mock.ddrb & hi) && (mock.portb & hi) &&
+        (mock.ddrb & lo) && !(mock.portb & lo) ) return i;
+  }
+  return -1;
+}
+
+static int Touched(void) {
+  int i;
+  for( i=0; i<touches; ++i )
+    if( Sec(now)>=touch_at[i] && Sec(now)<touch_at[i]+touch_len[i] ) return 1;
+  return 0;
+}
+
+// Latency of a state change in response to a touch that is going on
+static void Answer(void) {
+  double lat;
+
+  while( answered<touches && Sec(now)>=touch_at[answered] ) {
+    lat = Sec(now) - touch_at[answered];
+    if( lat<touch_len[answered] ) {
+      lat_sum += lat;
+      lat_n++;
+      if( lat>lat_max ) lat_max = lat;
+    }
+    answered++;
+  }
+}
+
+static unsigned Pad_cycles(void) {
+  return pad_base + (Touched() ? pad_touch : 0) + rand()%(pad_noise+1);
+}
+
+static void Pad_track(void) {
+  uint8_t c = !(mock.ddrb & (1 << PB2)) && (mock.portb & (1 << PB2));
+  if( c && !charging ) {
+    charge_at = now;
+    charge_len = Pad_cycles();
+  }
+  charging = c;
+  if( mock.ddrb & (1 << PB2) ) pad_v = mock.portb & (1 << PB2) ? vcc : 0;
+  else if( charging && now-charge_at>=charge_len ) pad_v = vcc;
+}
+
+// An LED line that floats after it was high keeps reading high for amb_ms,
+// the time the photo current of a reverse biased LED takes to discharge it
+// (Get_light()). Driving it low discharges it at once.
+static void Line_track(void) {
+  int p;
+
+  for( p=0; p<8; ++p ) {
+    uint8_t b = 1 << p;
+    if( !(LED_LINES & b) ) continue;
+    if( mock.portb & b ) { line_held |= b; line_at[p] = now; }
+    else if( mock.ddrb & b ) line_held &= ~b;
+  }
+}
+
+// Receive the telemetry on PB0: sample the level it had since the last access
+// of PORTB or DDRB in the middle of every bit, like a UART at UART_BAUD (8N1)
+// with an inverted input. An undriven PB0 is low, pulled by the transistor.
+static void Uart_track(void) {
+  const double bit = (double)F_CPU/UART_BAUD;
+  int level = !((mock.ddrb & 1) && ((mock.portb & 1) ||
+                (mock.tccr0a & ((1 << COM0A1) | (1 << COM0A0)))));
+
+  if( uart_f && uart_k<0 && !level ) {
+    uart_start = uart_at;
+    uart_k = 0;
+    uart_byte = 0;
+  }
+  while( uart_f && uart_k>=0 && uart_start+(uart_k+0.5)*bit<now ) {
+    if( uart_k>=1 && uart_k<=8 ) uart_byte |= level << (uart_k-1);
+    if( uart_k++<9 ) continue;
+    if( level ) { fputc(uart_byte, uart_f); ++uart_bytes; }
+    else ++uart_errors;         // no stop bit
+    uart_k = -1;
+  }
+  uart_at = now;
+}
+
+//#################################################################### Timers
+
+// Whether Timer0 plays the buzzer: its waveform on OC0A or its compare match
+// interrupt shaping pulses on PB0 (BUZZ_DUTY below 50)
+static int Buzzing(void) {
+  return (mock.tccr0b & 7) && (mock.ddrb & 1) &&
+         ((mock.tccr0a & ((1 << COM0A1) | (1 << COM0A0))) ||
+          (mock.timsk & (1 << OCIE0A)));
+}
+
+// Share of the time PB0 drives the buzzer right now
+static double Buzz_duty(void) {
+  if( !Buzzing() ) return 0;
+  if( mock.tccr0a & (1 << COM0A1) ) return mock.ocr0a/256.0; // fast PWM
+  if( mock.tccr0a & (1 << COM0A0) ) return 0.5;               // toggle
+  return mock.portb & 1;                                      // ISR pulses
+}
+
+// CPU cycles per count of Timer0, 0 if it is stopped
+static unsigned T0_div(void) {
+  static const unsigned div[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+  return div[mock.tccr0b & 7] << clk_shift;
+}
+
+static void T0_sync(void) {
+  unsigned d = T0_div();
+  uint64_t ticks;
+
+  if( !d || frozen ) { t0_at = now; return; }
+  ticks = (now-t0_at)/d;
+  t0_at += ticks*d;
+  if( (mock.tccr0a & 3)==(1 << WGM01) && mock.tcnt0<=mock.ocr0a ) {
+    // CTC: counts up to OCR0A and starts over
+    if( mock.tcnt0+ticks>mock.ocr0a ) mock.tifr |= (1 << OCF0A);
+    if( Buzzing() ) buzz_edges += (mock.tcnt0+ticks)/(mock.ocr0a+1);
+    mock.tcnt0 = (mock.tcnt0+ticks)%(mock.ocr0a+1);
+    return;
+  }
+  if( mock.tcnt0+ticks>255 ) mock.tifr |= (1 << TOV0);
+  mock.tcnt0 += ticks;
+}
+
+// Timer1 counts in eighths of an F_CPU cycle: its asynchronous clock from the
+// PLL runs at 64 MHz (8 times the RC oscillator, whatever CLKPR says)
+static unsigned T1_div(void) {
+  uint8_t cs = mock.tccr1 & 0x0f;
+
+  if( !cs ) return 0;
+  if( !(mock.pllcsr & (1 << PCKE)) ) return 8u << (cs-1+clk_shift);
+  if( !(mock.pllcsr & (1 << PLOCK)) )
+    Fail("Timer1 on the PLL before it locked");
+  return 1u << (cs-1);
+}
+
+static void T1_sync(void) {
+  unsigned div = T1_div();
+  uint64_t ticks;
+
+  if( !div || frozen ) { t1_at = now*8; return; }
+  ticks = (now*8-t1_at)/div;
+  if( mock.tcnt1+ticks>255 ) mock.tifr |= (1 << TOV1);
+  mock.tcnt1 += ticks;
+  t1_at += ticks*div;
+}
+
+static uint64_t T1_next(int mode) {
+  unsigned div = T1_div(), k;
+
+  if( mode==PWR_DOWN || !div || !(mock.timsk & (1 << OCIE1A)) )
+    return UINT64_MAX;
+  T1_sync();
+  k = (uint8_t)(mock.ocr1a-mock.tcnt1);
+  return (t1_at + (uint64_t)(k ? k : 256)*div + 7)/8;
+}
+
+static uint64_t T0_next(int mode) {
+  unsigned d = T0_div();
+
+  if( mode==PWR_DOWN || !d || !(mock.timsk & (1 << OCIE0A)) ||
+      (mock.tccr0a & 3)!=(1 << WGM01) ) return UINT64_MAX;
+  T0_sync();
+  if( mock.tcnt0>mock.ocr0a ) return t0_at + (256u-mock.tcnt0)*d;
+  return t0_at + (uint64_t)(mock.ocr0a-mock.tcnt0+1)*d;
+}
+
+static uint64_t Wdt_next(void) {
+  uint8_t p = (mock.wdtcr & 7) | ((mock.wdtcr >> 2) & 8);
+
+  if( !(mock.wdtcr & (1 << WDIE)) ) return UINT64_MAX;
+  return wdt_at + (uint64_t)((2048UL << p)*(F_CPU/wdt_hz));
+}
+
+//################################################################ Interrupts
+
+static int Pending(void) {
+  return ((mock.tifr & (1 << OCF1A)) && (mock.timsk & (1 << OCIE1A))) ||
+         ((mock.tifr & (1 << OCF0A)) && (mock.timsk & (1 << OCIE0A))) ||
+         ((mock.wdtcr & (1 << WDIF)) && (mock.wdtcr & (1 << WDIE)));
+}
+
+static void Isr(void (*vector)(void)) {
+  uint8_t ocr = mock.ocr1a;
+
+  mock.sreg &= ~I_BIT;
+  Advance(Cpu(ISR_CYCLES/2), ACTIVE);
+  if( vector ) vector();
+  // The LED engine moves OCR1A on from the match. If Timer1 is past the new
+  // value already, the match comes only after a wrap of 256 counts.
+  T1_sync();
+  if( vector==TIMER1_COMPA_vect && mock.ocr1a!=ocr &&
+      (uint8_t)(mock.tcnt1-ocr)>=(uint8_t)(mock.ocr1a-ocr) ) ++t1_missed;
+  Advance(Cpu(ISR_CYCLES/2), ACTIVE);
+  mock.sreg |= I_BIT;
+}
+
+static void Dispatch(void) {
+  while( mock.sreg & I_BIT ) {  // lowest vector number first, like the AVR
+    if( (mock.tifr & (1 << OCF1A)) && (mock.timsk & (1 << OCIE1A)) ) {
+      mock.tifr &= ~(1 << OCF1A);
+      Isr(TIMER1_COMPA_vect);
+    } else if( (mock.tifr & (1 << OCF0A)) && (mock.timsk & (1 << OCIE0A)) ) {
+      mock.tifr &= ~(1 << OCF0A);
+      Isr(TIMER0_COMPA_vect);
+    } else if( (mock.wdtcr & (1 << WDIF)) && (mock.wdtcr & (1 << WDIE)) ) {
+      mock.wdtcr &= ~(1 << WDIF);
+      Isr(WDT_vect);
+    } else break;
+  }
+}
+
+//############################################################# Virtual clock
+
+// What the micro controller, LEDs and buzzer draw right now, in uA
+static double Current(int mode, int led) {
+  double ua, mhz = F_CPU/1e6/(1 << clk_shift);
+
+  if( mode==ACTIVE ) ua = amp[I_ACTIVE]*mhz;
+  else if( mode==IDLE ) ua = amp[I_IDLE]*mhz;
+  else {
+    ua = amp[I_PWR_DOWN];
+    if( mock.wdtcr & ((1 << WDIE) | (1 << WDE)) ) ua += amp[I_WDT];
+    if( !(mock.mcucr & (1 << BODS)) ) ua += amp[I_BOD];
+    if( ~(mock.ddrb | mock.portb | mock.didr0) & 0x1f ) ua += amp[I_FLOAT];
+  }
+  if( mock.adcsra & (1 << ADEN) ) ua += amp[I_ADC];
+  if( mock.pllcsr & (1 << PLLE) ) ua += amp[I_PLL];
+  if( led>=0 && vcc>LED_VF ) ua += amp[I_LED]*(vcc-LED_VF)/(3.0-LED_VF);
+  ua += amp[I_BUZZER]*2*Buzz_duty();
+  return ua;
+}
+
+static void Account(uint64_t cycles, int mode) {
+  int led = Lit_led();
+
+  in_mode[mode] += cycles;
+  if( mode==PWR_DOWN ) {
+    // PB0 to PB4 that are inputs without pull-up and with an input buffer
+    if( ~(mock.ddrb | mock.portb | mock.didr0) & 0x1f ) floating += cycles;
+    if( mock.mcucr & (1 << BODS) ) bod_off += cycles;
+  }
+  if( mock.pllcsr & (1 << PLLE) ) pll_on += cycles;
+  cpu_cycles[mode] += cycles >> clk_shift;
+  charge[state] += Sec(cycles)*Current(mode, led);
+  in_state[state][mode] += cycles;
+  if( led>=0 ) led_on[led] += cycles;
+  if( Buzzing() ) {
+    buzz_on += cycles;
+    buzz_high += cycles*Buzz_duty();
+  }
+  now += cycles;
+}
+
+// Move the clock to the next event due no later than `until`, raise its flag
+static int Step(uint64_t until, int mode) {
+  uint64_t t0 = T0_next(mode), t1 = T1_next(mode), wdt = Wdt_next();
+  uint64_t next = t0<t1 ? t0 : t1;
+
+  if( wdt<next ) next = wdt;
+  if( next>until ) return 0;
+  if( next>now ) Account(next-now, mode);
+  if( next==t0 ) T0_sync();     // sets OCF0A
+  if( next==t1 ) { T1_sync(); mock.tifr |= (1 << OCF1A); }
+  if( next==wdt ) { wdt_at = next; mock.wdtcr |= (1 << WDIF); }
+  return 1;
+}
+
+static void Advance(uint64_t cycles, int mode) {
+  uint64_t until = now+cycles;
+
+  if( !(mock.clkpr & (1 << CLKPCE)) && (mock.clkpr & 0x0f)!=clk_shift ) {
+    T0_sync();                  // the timers counted with the old clock
+    T1_sync();
+    clk_shift = mock.clkpr & 0x0f;
+  }
+  Dispatch();
+  while( Step(until, mode) ) Dispatch();
+  if( until>now ) Account(until-now, mode);
+  if( state!=traced ) {
+    if( traced!=0xff ) Answer();
+    if( state==1 ) ++pomodoros; // WORK
+    if( !quiet ) printf("%12.6f s  state %d\n", Sec(now), state);
+    traced = state;
+  }
+  if( Buzzing() && !buzz_was && mock.ocr0a!=buzz_traced ) {  // a new tone
+    if( !quiet ) printf("%12.6f s  tone OCR0A %u\n", Sec(now), mock.ocr0a);
+    buzz_traced = mock.ocr0a;
+  }
+  buzz_was = Buzzing();
+  if( now>=end_at ) { Report(); exit(0); }
+}
+
+//################################################# Functions of avr-mock.h
+
+uint8_t *Mock_io(uint8_t *reg) {
+  Pad_track();
+  if( reg==&mock.portb || reg==&mock.ddrb ) { Uart_track(); Line_track(); }
+  ++io_count;
+  Advance(Cpu(1), ACTIVE);
+  return reg;
+}
+
+uint8_t *Mock_t0(uint8_t *reg) {
+  Mock_io(reg);
+  T0_sync();                    // count with the clock that was selected
+  if( reg==&mock.tccr0b ) t0_at = now;
+  return reg;
+}
+
+uint8_t *Mock_t1(uint8_t *reg) {
+  Mock_io(reg);
+  T1_sync();                    // count with the clock that was selected
+  if( reg==&mock.tccr1 ) t1_at = now*8;
+  return reg;
+}
+
+// The PLL locks PLL_LOCK after PLLE is set. A write only shows with the next
+// access, which is close enough for the firmware's wait loop.
+uint8_t *Mock_pll(uint8_t *reg) {
+  Mock_io(reg);
+  T1_sync();                    // PCKE may be about to change Timer1's clock
+  if( !(mock.pllcsr & (1 << PLLE)) ) { mock.pllcsr = 0; pll_at = 0; }
+  else if( !pll_at ) pll_at = now;
+  else if( Sec(now-pll_at)>=PLL_LOCK ) mock.pllcsr |= (1 << PLOCK);
+  return reg;
+}
+
+// The ADC converts the channel ADMUX selects against VCC. Modelled are the
+// bandgap (MUX 1100), ADC0 (RESET, always at VCC) and ADC1 (the pad, which
+// shares its charge with the sample and hold capacitor when it floats).
+// Everything else reads zero.
+static void Adc_sync(void) {
+  unsigned div = 2 << ((mock.adcsra & 7) ? (mock.adcsra & 7)-1 : 0);
+  double c;
+
+  if( !(mock.adcsra & (1 << ADEN)) ) { mock.adcsra &= ~(1 << ADSC); return; }
+  Pad_track();
+  if( (mock.admux & 0x0f)==0 ) sh_v = vcc;
+  if( (mock.admux & 0x0f)==1 && !(mock.ddrb & (1 << PB2)) ) {
+    c = Pad_cycles()*PAD_PF;
+    sh_v = pad_v = (sh_v*SH_PF + pad_v*c)/(SH_PF + c);
+  }
+  if( !(mock.adcsra & (1 << ADSC)) ) { adc_at = 0; return; }
+  if( !adc_at ) adc_at = now;
+  if( now-adc_at < Cpu(25*div) ) return;  // first conversion: 25 ADC clocks
+  mock.adcsra &= ~(1 << ADSC);
+  mock.adcsra |= (1 << ADIF);
+  switch( mock.admux & 0x0f ) {
+    case 0x0c: mock.adc = (uint16_t)(1.1*1024/vcc); break;
+    case 0x00:
+    case 0x01: mock.adc = (uint16_t)(sh_v*1024/vcc); break;
+    default:   mock.adc = 0;                         break;
+  }
+  if( mock.adc>1023 ) mock.adc = 1023;
+  adc_at = 0;
+}
+
+uint8_t *Mock_adc(uint8_t *reg) {
+  Mock_io(reg);
+  Adc_sync();
+  return reg;
+}
+
+uint16_t Mock_adcw(void) {
+  Mock_io((uint8_t *)&mock.adc);
+  Adc_sync();
+  return mock.adc;
+}
+
+uint8_t Mock_adch(void) {
+  Mock_io((uint8_t *)&mock.adc);
+  Adc_sync();
+  return mock.admux & (1 << ADLAR) ? mock.adc >> 2 : mock.adc >> 8;
+}
+
+uint8_t Mock_tifr(void) {
+  Mock_io(&mock.tifr);
+  T0_sync();
+  T1_sync();
+  return mock.tifr;
+}
+
+void Mock_clear_tifr(uint8_t flags) {
+  Mock_io(&mock.tifr);
+  T0_sync();
+  T1_sync();
+  mock.tifr &= ~flags;
+}
+
+uint8_t Mock_pinb(void) {
+  uint8_t pin = mock.portb & mock.ddrb & ~(1 << PB2) & ~mock.didr0;
+  int p;
+
+  Pad_track();
+  Line_track();
+  for( p=0; p<8; ++p )
+    if( (line_held & ~mock.ddrb & ~mock.didr0 & (1 << p)) &&
+        Sec(now-line_at[p])*1e3<amb_ms ) pin |= 1 << p;
+  ++io_count;
+  Advance(Cpu(POLL_CYCLES), ACTIVE);
+  if( mock.ddrb & (1 << PB2) ) pin |= mock.portb & (1 << PB2);
+  else if( charging && now-charge_at>=charge_len && !(mock.didr0 & (1 << PB2)) )
+    pin |= (1 << PB2);
+  return pin;
+}
+
+void Mock_sei(void) {
+  mock.sreg |= I_BIT;           // ISRs run with the next access, so a sleep
+}                               // right after sei() still sees them pending
+
+void Mock_cli(void) {
+  mock.sreg &= ~I_BIT;
+  Advance(Cpu(1), ACTIVE);
+}
+
+void Mock_delay(double cycles) {
+  Pad_track();
+  Advance(Cpu((uint64_t)(cycles+0.5)), ACTIVE);
+}
+
+void set_sleep_mode(uint8_t mode) {
+  sleep_as = mode;
+}
+
+void sleep_mode(void) {
+  int mode = sleep_as==SLEEP_MODE_PWR_DOWN ? PWR_DOWN : IDLE;
+
+  if( !(mock.sreg & I_BIT) ) Fail("sleeping with interrupts disabled");
+  if( Pending() ) {
+    mock.mcucr &= ~(1 << BODS);
+    Advance(Cpu(1), ACTIVE);
+    return;
+  }
+  Advance(Cpu(1), ACTIVE);
+  T0_sync();
+  T1_sync();
+  frozen = mode==PWR_DOWN;
+  if( !Step(UINT64_MAX, mode) ) Fail("sleeping without a wake-up source");
+  T0_sync();
+  T1_sync();
+  frozen = 0;
+  mock.mcucr &= ~(1 << BODS);   // BOD is back on after waking up
+  Advance(Cpu(6), ACTIVE);      // start-up time of the internal RC oscillator
+  Dispatch();
+}
+
+static uint8_t *Ee_cell(const void *addr) {
+  long i = (const uint8_t *)addr - __start_mock_eeprom;
+
+  if( i<0 || i>=EE_SIZE ) Fail("EEPROM address out of range");
+  return &eeprom[i];
+}
+
+uint8_t eeprom_read_byte(const uint8_t *addr) {
+  Advance(Cpu(4), ACTIVE);
+  return *Ee_cell(addr);
+}
+
+void eeprom_update_byte(uint8_t *addr, uint8_t value) {
+  uint8_t *cell = Ee_cell(addr);
+
+  Advance(Cpu(4), ACTIVE);
+  if( *cell==value ) return;
+  Advance((uint64_t)(EE_WRITE_S*F_CPU), ACTIVE);  // busy waits on EEPE
+  *cell = value;
+  ++ee_writes;
+}
+
+void eeprom_read_block(void *dst, const void *src, unsigned n) {
+  unsigned i;
+  for( i=0; i<n; ++i )
+    ((uint8_t *)dst)[i] = eeprom_read_byte((const uint8_t *)src+i);
+}
+
+void eeprom_update_block(const void *src, void *dst, unsigned n) {
+  unsigned i;
+  for( i=0; i<n; ++i )
+    eeprom_update_byte((uint8_t *)dst+i, ((const uint8_t *)src)[i]);
+}
+
+// Words are little endian on the AVR as on the host
+uint16_t eeprom_read_word(const uint16_t *addr) {
+  uint16_t v;
+  eeprom_read_block(&v, addr, sizeof v);
+  return v;
+}
+
+void eeprom_update_word(uint16_t *addr, uint16_t value) {
+  eeprom_update_block(&value, addr, sizeof value);
+}
+
+uint32_t eeprom_read_dword(const uint32_t *addr) {
+  uint32_t v;
+  eeprom_read_block(&v, addr, sizeof v);
+  return v;
+}
+
+void eeprom_update_dword(uint32_t *addr, uint32_t value) {
+  eeprom_update_block(&value, addr, sizeof value);
+}
+
+static void Ee_save(void) {
+  FILE *f;
+
+  if( !ee_file || !(f = fopen(ee_file, "wb")) ) return;
+  fwrite(eeprom, 1, EE_SIZE, f);
+  fclose(f);
+}
+
+void wdt_reset(void) {
+  Advance(Cpu(1), ACTIVE);
+  wdt_at = now;
+}
+
+void wdt_disable(void) {
+  Advance(Cpu(5), ACTIVE);
+  mock.wdtcr = 0;
+  wdt_at = now;
+}
+
+//##################################################################### Driver
+
+int main(int argc, char **argv) {
+  int opt, i, day = 0, sec_set = 0;
+  size_t n;
+  double sec = 3600;
+  char *len;
+
+  FILE *f;
+
+  while( (opt = getopt(argc, argv, "t:b:d:n:w:v:a:qe:i:p:u:"))!=-1 ) {
+    switch( opt ) {
+      case 't': sec = atof(optarg); sec_set = 1;      break;
+      case 'b': pad_base = atoi(optarg);              break;
+      case 'd': pad_touch = atoi(optarg);             break;
+      case 'n': pad_noise = atoi(optarg);             break;
+      case 'w': wdt_hz *= 1+atof(optarg)/100;         break;
+      case 'v': vcc = atof(optarg);                   break;
+      case 'a': amb_ms = atof(optarg);                break;
+      case 'q': quiet = 1;                            break;
+      case 'e': ee_file = optarg;                     break;
+      case 'i':
+        for( i=0; i<I_N; ++i ) {
+          n = strlen(amp_name[i]);
+          if( !strncmp(optarg, amp_name[i], n) && optarg[n]=='=' ) break;
+        }
+        if( i==I_N ) goto usage;
+        amp[i] = atof(optarg+n+1);
+        break;
+      case 'p': day = atoi(optarg);                   break;
+      case 'u':
+        if( (uart_f = fopen(optarg, "wb")) ) break;
+        perror(optarg);
+        return 2;
+      default:
+      usage:
+        fprintf(stderr, "usage: %s [-t sec] [-b cyc] [-d cyc] [-n cyc] "
+                "[-w %%] [-v V] [-a ms] [-q] [-e file] [-i name=uA] [-p n] "
+                "[-u file] [touch[:length]] ...\n", argv[0]);
+        return 2;
+    }
+  }
+  for( ; optind<argc && touches<MAX_TOUCH; ++optind, ++touches ) {
+    touch_at[touches] = strtod(argv[optind], &len);
+    touch_len[touches] = *len==':' ? atof(len+1) : 0.3;
+  }
+  // A day of use: pomodoros back to back, each rest started DAY_WAIT after
+  // the work period is over, idle for the rest of the day
+  for( i=0; i<day && touches+2<=MAX_TOUCH; ++i ) {
+    touch_at[touches] = DAY_START+i*(30*60+DAY_WAIT+DAY_GAP);
+    touch_at[touches+1] = touch_at[touches]+25*60+DAY_WAIT;
+    touch_len[touches] = touch_len[touches+1] = 1.2;
+    touches += 2;
+  }
+  if( day && !sec_set ) sec = 86400;
+
+  memset(eeprom, 0xff, EE_SIZE);  // erased
+  if( ee_file && (f = fopen(ee_file, "rb")) ) {
+    if( fread(eeprom, 1, EE_SIZE, f)!=EE_SIZE ) memset(eeprom, 0xff, EE_SIZE);
+    fclose(f);
+  }
+  atexit(Ee_save);
+  end_at = (uint64_t)(sec*F_CPU);
+  srand(1);
+  Firmware_main();
+  Report();
+  return 0;
+}
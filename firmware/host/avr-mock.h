@@ -0,0 +1,227 @@
+/* Indent: space, Tabsize: 4, Encoding: UTF-8, Language: C/Eng, Breaks: linux */
+/**
+ * \file avr-mock.h
+ *
+ * Mock register file and virtual clock for building To-mate-Oh on a host.
+ *
+ * Stands in for the avr-libc headers when the firmware is compiled with HOST
+ * defined (see "make host"). Registers are fields of a struct. Every access
+ * goes through a small function that advances a virtual clock counted in CPU
+ * cycles, so Timer1, the watchdog, the capacitive pad on PB2 and the sleep
+ * modes behave (roughly) like on the ATTiny. Delays and sleeps advance the
+ * clock by their full length, plain C code costs nothing. Interrupt service
+ * routines are called by the mock when their event comes due.
+ *
+ * \date 17 Oct 2026
+ * \author <a href="mailto:con-f-use@gmx.net">con-f-use</a>
+ * \copyright
+ * This file is part of To-mate-Oh. Copyright © 2026 con-f-use. Use permitted
+ * under GNU General Public License v3.0.
+ */
+
+#ifndef ___TomateOh_avr_mock_h___
+#define ___TomateOh_avr_mock_h___
+
+#include <stdint.h>
+
+// MOCK REGISTER FILE
+/** I/O registers of the ATTiny25 that the firmware uses. */
+struct Mock_regs {
+  uint8_t ddrb, portb, sreg, mcusr, mcucr, wdtcr, prr;
+  uint8_t tccr0a, tccr0b, tcnt0, ocr0a, ocr0b;
+  uint8_t tccr1, tcnt1, ocr1a, ocr1b, ocr1c;
+  uint8_t timsk, tifr, gtccr, pllcsr, clkpr;
+  uint8_t admux, adcsra, adcsrb, didr0, acsr;
+  uint16_t adc;
+};
+extern struct Mock_regs mock;
+
+uint8_t *Mock_io(uint8_t *reg);
+uint8_t *Mock_t0(uint8_t *reg);
+uint8_t *Mock_t1(uint8_t *reg);
+uint8_t *Mock_pll(uint8_t *reg);
+uint8_t *Mock_adc(uint8_t *reg);
+uint16_t Mock_adcw(void);
+uint8_t Mock_adch(void);
+uint8_t Mock_pinb(void);
+uint8_t Mock_tifr(void);
+void Mock_clear_tifr(uint8_t flags);
+
+#define DDRB   (*Mock_io(&mock.ddrb))
+#define PORTB  (*Mock_io(&mock.portb))
+#define PINB   (Mock_pinb())
+#define SREG   (*Mock_io(&mock.sreg))
+#define MCUSR  (*Mock_io(&mock.mcusr))
+#define MCUCR  (*Mock_io(&mock.mcucr))
+#define WDTCR  (*Mock_io(&mock.wdtcr))
+#define PRR    (*Mock_io(&mock.prr))
+#define TCCR0A (*Mock_io(&mock.tccr0a))
+#define TCCR0B (*Mock_t0(&mock.tccr0b))
+#define TCNT0  (*Mock_t0(&mock.tcnt0))
+#define OCR0A  (*Mock_io(&mock.ocr0a))
+#define OCR0B  (*Mock_io(&mock.ocr0b))
+#define TCCR1  (*Mock_t1(&mock.tccr1))
+#define TCNT1  (*Mock_t1(&mock.tcnt1))
+#define OCR1A  (*Mock_io(&mock.ocr1a))
+#define OCR1B  (*Mock_io(&mock.ocr1b))
+#define OCR1C  (*Mock_io(&mock.ocr1c))
+#define TIMSK  (*Mock_io(&mock.timsk))
+#define TIFR   (Mock_tifr())
+#define GTCCR  (*Mock_io(&mock.gtccr))
+#define PLLCSR (*Mock_pll(&mock.pllcsr))
+#define CLKPR  (*Mock_io(&mock.clkpr))
+#define ADMUX  (*Mock_adc(&mock.admux))
+#define ADCSRA (*Mock_adc(&mock.adcsra))
+#define ADCSRB (*Mock_adc(&mock.adcsrb))
+#define DIDR0  (*Mock_io(&mock.didr0))
+#define ACSR   (*Mock_io(&mock.acsr))
+#define ADC    (Mock_adcw())
+#define ADCH   (Mock_adch())
+
+/** Clear timer interrupt flags, writing a one to a flag clears it. */
+#define Clear_tifr(flags) Mock_clear_tifr(flags)
+
+// REGISTER BITS
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define DDB0 0
+#define DDB1 1
+#define DDB2 2
+#define DDB3 3
+#define DDB4 4
+#define DDB5 5
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define CS13 3
+#define COM1A0 4
+#define COM1A1 5
+#define PWM1A 6
+#define CTC1 7
+#define TOIE0 1
+#define TOIE1 2
+#define OCIE0B 3
+#define OCIE0A 4
+#define OCIE1B 5
+#define OCIE1A 6
+#define TOV0 1
+#define TOV1 2
+#define OCF0B 3
+#define OCF0A 4
+#define OCF1B 5
+#define OCF1A 6
+#define PLOCK 0
+#define PLLE 1
+#define PCKE 2
+#define LSM 7
+#define WDP0 0
+#define WDP1 1
+#define WDP2 2
+#define WDE 3
+#define WDCE 4
+#define WDP3 5
+#define WDIE 6
+#define WDIF 7
+#define BODSE 2
+#define SM0 3
+#define SM1 4
+#define SE 5
+#define PUD 6
+#define BODS 7
+#define PRADC 0
+#define PRUSI 1
+#define PRTIM0 2
+#define PRTIM1 3
+#define WGM00 0
+#define WGM01 1
+#define COM0B0 4
+#define COM0B1 5
+#define COM0A0 6
+#define COM0A1 7
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define WGM02 3
+#define CLKPCE 7
+#define MUX0 0
+#define MUX1 1
+#define MUX2 2
+#define MUX3 3
+#define ADLAR 5
+#define REFS0 6
+#define REFS1 7
+#define REFS2 4
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADIE 3
+#define ADIF 4
+#define ADATE 5
+#define ADSC 6
+#define ADEN 7
+#define ACD 7
+
+// INTERRUPTS (the firmware defines the vectors it uses)
+#define ISR(vector) void vector(void)
+#define EMPTY_INTERRUPT(vector) void vector(void) {}
+void WDT_vect(void) __attribute__((weak));
+void TIMER0_COMPA_vect(void) __attribute__((weak));
+void TIMER1_COMPA_vect(void) __attribute__((weak));
+void Mock_sei(void);
+void Mock_cli(void);
+#define sei() Mock_sei()
+#define cli() Mock_cli()
+
+// DELAYS, SLEEP, WATCHDOG AND POWER
+void Mock_delay(double cycles);
+#define _delay_us(us) Mock_delay((us)*(F_CPU/1e6))
+#define _delay_ms(ms) Mock_delay((ms)*(F_CPU/1e3))
+
+#define SLEEP_MODE_IDLE     0
+#define SLEEP_MODE_ADC      1
+#define SLEEP_MODE_PWR_DOWN 2
+void set_sleep_mode(uint8_t mode);
+void sleep_mode(void);
+#define sleep_cpu() sleep_mode()
+#define sleep_enable()  ((void)0)
+#define sleep_disable() ((void)0)
+#define sleep_bod_disable() (MCUCR |= (1 << BODS) | (1 << BODSE), \
+                             MCUCR &= ~(1 << BODSE))
+
+#define WDTO_15MS  0
+#define WDTO_30MS  1
+#define WDTO_60MS  2
+#define WDTO_120MS 3
+#define WDTO_250MS 4
+#define WDTO_500MS 5
+#define WDTO_1S    6
+#define WDTO_2S    7
+#define WDTO_4S    8
+#define WDTO_8S    9
+void wdt_reset(void);
+void wdt_disable(void);
+
+// PROGRAM MEMORY (flash and RAM are one on the host)
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+
+// EEPROM (variables in it live in a section of their own and are only used
+// for their addresses, the mock maps those to its EEPROM image)
+#define EEMEM __attribute__((section("mock_eeprom")))
+uint8_t eeprom_read_byte(const uint8_t *addr);
+void eeprom_update_byte(uint8_t *addr, uint8_t value);
+uint16_t eeprom_read_word(const uint16_t *addr);
+void eeprom_update_word(uint16_t *addr, uint16_t value);
+uint32_t eeprom_read_dword(const uint32_t *addr);
+void eeprom_update_dword(uint32_t *addr, uint32_t value);
+void eeprom_read_block(void *dst, const void *src, unsigned n);
+void eeprom_update_block(const void *src, void *dst, unsigned n);
+
+#define power_all_disable() (PRR = 0x0f)
+#define power_all_enable()  (PRR = 0x00)
+
+#endif
@@ -0,0 +1,77 @@
+/* Indent: space, Tabsize: 4, Encoding: UTF-8, Language: C/Eng, Breaks: linux */
+/**
+ * \file counters.c
+ *
+ * Decoder of the activity counters a firmware built with COUNTERS keeps in
+ * the EEPROM (struct Ee_ctr in To-mate-Oh.h).
+ *
+ *     ./To-mate-Oh-counters eeprom.bin offset
+ *
+ * eeprom.bin is a raw image of the EEPROM, read with avrdude ("make counters"
+ * does both) or written by the mock's -e option. offset is where ee_ctr sits
+ * in it, avr-nm prints it as 0x81xxxx (or nm of the host build relative to
+ * __start_mock_eeprom).
+ *
+ * \date 17 Oct 2026
+ * \author <a href="mailto:con-f-use@gmx.net">con-f-use</a>
+ * \copyright
+ * This file is part of To-mate-Oh. Copyright © 2026 con-f-use. Use permitted
+ * under GNU General Public License v3.0.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define EE_SIZE 128     // bytes of EEPROM of the ATTiny25
+#define CTR_LEN 20      // sizeof(struct Ee_ctr)
+#define TICK_MS 16      // TICK_MS of To-mate-Oh.h
+
+// Little endian value of n bytes, as avr-gcc stores them
+static unsigned long Get(const uint8_t *p, int n) {
+  unsigned long v = 0;
+  while( n-- ) v = v << 8 | p[n];
+  return v;
+}
+
+int main(int argc, char **argv) {
+  uint8_t ee[EE_SIZE];
+  const uint8_t *c;
+  unsigned long off, done, aborted;
+  FILE *f;
+
+  if( argc!=3 ) {
+    fprintf(stderr, "usage: %s eeprom.bin offset\n", argv[0]);
+    return 2;
+  }
+  off = strtoul(argv[2], NULL, 16) & 0xffff;  // avr-nm: 0x810000 + offset
+  if( off+CTR_LEN>EE_SIZE ) {
+    fprintf(stderr, "offset 0x%lx is outside the EEPROM\n", off);
+    return 2;
+  }
+  if( !(f = fopen(argv[1], "rb")) || fread(ee, 1, EE_SIZE, f)<off+CTR_LEN ) {
+    perror(argv[1]);
+    return 2;
+  }
+  fclose(f);
+  c = ee+off;
+  if( Get(c, 4)==0xffffffffUL ) {
+    printf("no counters saved yet (erased EEPROM)\n");
+    return 0;
+  }
+  done = Get(c+14, 2);
+  aborted = Get(c+16, 2);
+  printf("wakes from power down %10lu\n", Get(c, 4));
+  printf("button scans          %10lu\n", Get(c+4, 4));
+  printf("awake (LEDs, buzzer)  %10lu ticks, %.1f h\n", Get(c+8, 4),
+         Get(c+8, 4)*TICK_MS/3.6e6);
+  printf("touches detected      %10lu\n", Get(c+12, 2));
+  printf("pomodoros completed   %10lu\n", done);
+  printf("pomodoros aborted     %10lu\n", aborted);
+  printf("calibrations failed   %10lu\n", Get(c+18, 2));
+  if( done+aborted )
+    printf("per pomodoro          %10.1f scans, %.1f min awake\n",
+           Get(c+4, 4)/(double)(done+aborted),
+           Get(c+8, 4)*TICK_MS/6e4/(done+aborted));
+  return 0;
+}
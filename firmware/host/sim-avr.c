@@ -0,0 +1,588 @@
+/* Indent: space, Tabsize: 4, Encoding: UTF-8, Language: C/Eng, Breaks: linux */
+/**
+ * \file sim-avr.c
+ *
+ * End-to-end test of the real firmware image under simavr.
+ *
+ * Where ./host/avr-mock.c compiles the firmware for the host, this runs the
+ * very To-mate-Oh.elf that gets flashed, instruction by instruction on
+ * simavr's core for the CPU of the Makefile (MMCU), with a stand-in for the
+ * capacitive pad on PB2. The pad reads low while PB2 is discharged and high a
+ * scripted number of CPU cycles after the pull-up is turned on. Sleeps are
+ * fast-forwarded to the next wake-up, so a pomodoro takes seconds. The system
+ * clock prescaler (CLKPR), which simavr does not model, is emulated by slowing
+ * down the core. The watchdog runs from its own oscillator, so its pending
+ * timeout is rescaled to the new clock on every switch.
+ *
+ *     ./To-mate-Oh-sim [-f elf] [-t sec] [-b cyc] [-d cyc] [-v V] [-q]
+ *                      [-s state,...] [-l state:sec] [-p state:leds]
+ *                      [-z state] [-B budgets] [touch[:length]] ...
+ *
+ * -f is the firmware (To-mate-Oh.elf), -t the simulated time in seconds
+ * (default 3600), -b and -d the charge time of the untouched pad and what a
+ * finger adds to it in CPU cycles (20, 20), -v the supply voltage (3.0) and -q
+ * suppresses the trace of state changes. Touches are given as for the mock.
+ *
+ * The rest are assertions, checked at the end: -s the exact sequence of states
+ * entered after power-up, -l the length of every visit of a state (within 1%),
+ * -p a mask of LEDs that must each have lit in a state and -z a state the
+ * buzzer must have sounded in. -l, -p and -z may be given more than once. A
+ * failed assertion is printed and makes the exit status 1, so "make simtest"
+ * catches timing drift, and the awake cycles in the report power regressions.
+ *
+ * -B runs microbenchmarks once the simulated time is up: the primitives the
+ * timing of the firmware rests on (the LED engine, Get_time() at several pad
+ * capacities, Sleep_now(), one pass of the main loop, see benches[]) are
+ * called and their exact cycle counts, without sleep, compared to the budgets
+ * in the file. For every one the firmware is booted on a fresh core and run
+ * to the same point again, so each starts from the same state of registers,
+ * peripherals and pending timers. "make bench" does that with
+ * host/budgets.txt, its output is in the same format. -R pct records instead:
+ * the number of every benchmark in the file is replaced by the cycles it took
+ * plus pct percent, comments and order are kept ("make budgets").
+ *
+ * \date 17 Oct 2026
+ * \author <a href="mailto:con-f-use@gmx.net">con-f-use</a>
+ * \copyright
+ * This file is part of To-mate-Oh. Copyright © 2026 con-f-use. Use permitted
+ * under GNU General Public License v3.0.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_io.h>
+#include <simavr/sim_cycle_timers.h>
+#include <simavr/avr_ioport.h>
+#include <simavr/avr_watchdog.h>
+
+#ifndef MMCU
+#define MMCU        "attiny25"  // simavr core, the Makefile passes its CPU
+#endif
+#define DDRB_ADDR   0x37    // data space addresses of the ATTiny25/45/85
+#define PORTB_ADDR  0x38
+#define CLKPR_ADDR  0x46
+#define OCR1A_ADDR  0x4e
+#define CLKPCE      7
+#define PAD         (1 << 2)
+#define STATES      256
+#define MAX_TOUCH   64
+#define MAX_VISIT   256
+#define MAX_CHECK   16
+#define BUZZ_GAP    1e-3    // longest half period of a tone on PB0
+#define SP_ADDR     0x5d    // SPL, SPH follows
+#define MAX_BENCH   32
+
+// SETTINGS
+static const char *elf_file = "To-mate-Oh.elf";
+static unsigned pad_base = 20, pad_touch = 20;
+static double   vcc = 3.0;
+static double   touch_at[MAX_TOUCH], touch_len[MAX_TOUCH];
+static int      touches, quiet;
+static const char *budget_file;
+static int      headroom = -1;  // -R: percent added to the recorded budgets
+
+// ASSERTIONS
+static int      want_seq[MAX_VISIT], want_seqs = -1;
+static int      want_len[MAX_CHECK], want_lens;
+static double   want_sec[MAX_CHECK];
+static int      want_led[MAX_CHECK], want_mask[MAX_CHECK], want_leds;
+static int      want_buzz[MAX_CHECK], want_buzzes;
+
+// SIMULATION
+static elf_firmware_t fw;
+static avr_t    *avr;
+static avr_irq_t *pad_irq;
+static uint16_t state_addr;     // address of the firmware's `state` in SRAM
+static double   sec_at;         // time at cycle cyc_at, moved on clock changes
+static avr_cycle_count_t cyc_at;
+static uint8_t  clk_shift;      // CPU clock is F_CPU>>clk_shift (CLKPR)
+static avr_cycle_count_t clkpce_at; // CLKPCE written, CLKPR open 4 cycles
+static uint8_t  charging;       // pad pulled up as an input
+static int      state = -1;     // last state seen
+static double   state_at;       // when it was entered
+static int      lit = -1;       // LED that is lit
+static double   lit_at;
+static double   pb0_at = -1;    // last change of PB0
+static avr_cycle_count_t call_at;   // Call() started
+static avr_cycle_count_t ocr1a_in;  // cycles from then to the first OCR1A write
+
+// STATISTICS
+static int      visit[MAX_VISIT], visits;  // states entered, in order
+static double   visit_at[MAX_VISIT];
+static double   in_state[STATES], awake[STATES], buzz_on[STATES];
+static double   led_on[STATES][6];
+static uint64_t cycles[STATES];  // CPU cycles executed (not slept) per state
+
+static double Now(void) {
+  return sec_at + (avr->cycle-cyc_at)/(double)avr->frequency;
+}
+
+static int Touched(void) {
+  int i;
+  for( i=0; i<touches; ++i )
+    if( Now()>=touch_at[i] && Now()<touch_at[i]+touch_len[i] ) return 1;
+  return 0;
+}
+
+// Address of a function in flash or a variable in SRAM, from the symbol table
+// of the firmware
+static uint16_t Symbol(const char *name) {
+  char cmd[256], line[256], sym[128], type;
+  unsigned long addr;
+  FILE *p;
+
+  snprintf(cmd, sizeof cmd, "avr-nm %s", elf_file);
+  if( !(p = popen(cmd, "r")) ) return 0;
+  while( fgets(line, sizeof line, p) )
+    if( sscanf(line, "%lx %c %127s", &addr, &type, sym)==3 &&
+        !strcmp(sym, name) ) { pclose(p); return addr & 0xffff; }
+  pclose(p);
+  return 0;
+}
+
+//####################################################################### State
+
+// Length of a visit, the last one is still going on
+static double Visit_sec(int i) {
+  return (i+1<visits ? visit_at[i+1] : Now())-visit_at[i];
+}
+
+// Account the time in the current state up to now
+static void Account(void) {
+  in_state[state] += Now()-state_at;
+  state_at = Now();
+  if( lit>=0 ) led_on[state][lit] += Now()-lit_at;
+  lit_at = Now();
+}
+
+//######################################################################### Pad
+
+static avr_cycle_count_t Pad_charged(avr_t *a, avr_cycle_count_t when,
+                                     void *param) {
+  (void)a; (void)when; (void)param;
+  avr_raise_irq(pad_irq, 1);
+  return 0;
+}
+
+// Called on every write to DDRB or PORTB, so also tracks the lit LED
+static void Pins(struct avr_irq_t *irq, uint32_t value, void *param) {
+  // (high pin, low pin) of every LED, in the order of Set_leds()
+  static const uint8_t pins[6][2] = {{4,1},{1,4},{1,3},{3,1},{3,4},{4,3}};
+  uint8_t ddr = avr->data[DDRB_ADDR], port = avr->data[PORTB_ADDR], c;
+  int i, led = -1;
+
+  (void)irq; (void)value; (void)param;
+  c = !(ddr & PAD) && (port & PAD);
+  if( c && !charging ) {          // pull-up on, pad charges from empty
+    avr_raise_irq(pad_irq, 0);
+    avr_cycle_timer_register(avr, (pad_base+(Touched() ? pad_touch : 0)) >>
+                             clk_shift, Pad_charged, NULL);
+  } else if( !c ) avr_cycle_timer_cancel(avr, Pad_charged, NULL);
+  charging = c;
+
+  for( i=0; i<6; ++i ) {
+    uint8_t hi = 1 << pins[i][0], lo = 1 << pins[i][1];
+    if( (ddr & hi) && (port & hi) && (ddr & lo) && !(port & lo) ) led = i;
+  }
+  if( led!=lit ) {
+    if( state>=0 ) Account();
+    lit = led;
+  }
+}
+
+// Timer0 toggles PB0 while the buzzer sounds
+static void Buzzer(struct avr_irq_t *irq, uint32_t value, void *param) {
+  (void)irq; (void)value; (void)param;
+  if( pb0_at>=0 && Now()-pb0_at<BUZZ_GAP && state>=0 )
+    buzz_on[state] += Now()-pb0_at;
+  pb0_at = Now();
+}
+
+//####################################################################### Clock
+
+// simavr turns the watchdog's period into CPU cycles at avr->frequency when
+// WDTCR is written. Its oscillator does not care about CLKPR, so the cycles
+// left of the pending timeout and of the following ones scale with the clock.
+static void Wdt_rescale(avr_t *a, uint32_t old_hz) {
+  avr_watchdog_t *w = NULL;
+  avr_io_t *io;
+  avr_cycle_timer_slot_p s;
+  avr_cycle_count_t left;
+
+  for( io=a->io_port; io; io=io->next )
+    if( io->kind && !strcmp(io->kind, "watchdog") ) w = (avr_watchdog_t *)io;
+  if( !w ) return;
+  w->cycle_count = w->cycle_count*a->frequency/old_hz;
+  for( s=a->cycle_timers.timer; s; s=s->next )
+    if( s->param==w ) {
+      left = s->when>a->cycle ? s->when-a->cycle : 0;
+      avr_cycle_timer_register(a, left*a->frequency/old_hz, s->timer, w);
+      break;                    // registering again dropped this slot
+    }
+}
+
+// simavr runs the core at avr->frequency; the prescaler divides it
+static void Clkpr(avr_t *a, avr_io_addr_t addr, uint8_t v, void *param) {
+  uint32_t hz = a->frequency;
+
+  (void)param;
+  if( v & (1 << CLKPCE) ) {     // unlock only, the prescaler stays
+    clkpce_at = a->cycle;
+    a->data[addr] = clk_shift;
+  } else if( a->cycle-clkpce_at<=4 ) {
+    sec_at = Now();
+    cyc_at = a->cycle;
+    clk_shift = v & 0x0f;
+    a->frequency = F_CPU >> clk_shift;
+    if( a->frequency!=hz ) Wdt_rescale(a, hz);
+    a->data[addr] = clk_shift;
+  }                             // too late after the unlock: ignored
+}
+
+// The LED engine's interrupt has to move OCR1A on before Timer1 gets there
+static void Ocr1a(avr_t *a, avr_io_addr_t addr, uint8_t v, void *param) {
+  (void)addr; (void)v; (void)param;
+  if( !ocr1a_in ) ocr1a_in = a->cycle-call_at;
+}
+
+// Sleeps are fast-forwarded, the default callback would sleep in real time
+static void Sleep_none(avr_t *a, avr_cycle_count_t how_long) {
+  (void)a; (void)how_long;
+}
+
+//################################################################### Reporting
+
+static void State_changed(int s) {
+  if( state>=0 ) Account();
+  if( !quiet ) printf("%12.6f s  state %d\n", Now(), s);
+  if( visits<MAX_VISIT ) { visit[visits] = s; visit_at[visits++] = Now(); }
+  state = s;
+}
+
+static int Check(void) {
+  int i, j, fail = 0;
+
+  if( want_seqs>=0 ) {
+    for( i=0; i<want_seqs && i+1<visits && visit[i+1]==want_seq[i]; ++i );
+    if( i<want_seqs || visits-1>want_seqs ) {
+      printf("FAIL state sequence:");
+      for( i=1; i<visits; ++i ) printf(" %d", visit[i]);
+      printf("\n");
+      fail = 1;
+    }
+  }
+  for( j=0; j<want_lens; ++j )   // the last visit is cut short by -t
+    for( i=1; i<visits-1; ++i ) {
+      double d = Visit_sec(i)-want_sec[j];
+      if( visit[i]!=want_len[j] || (d<0 ? -d : d)<=want_sec[j]/100 ) continue;
+      printf("FAIL state %d lasted %.3f s, not %.3f s\n", visit[i],
+             Visit_sec(i), want_sec[j]);
+      fail = 1;
+    }
+  for( j=0; j<want_leds; ++j )
+    for( i=0; i<6; ++i )
+      if( (want_mask[j] >> i & 1) && !led_on[want_led[j]][i] ) {
+        printf("FAIL led %d never lit in state %d\n", i, want_led[j]);
+        fail = 1;
+      }
+  for( j=0; j<want_buzzes; ++j )
+    if( !buzz_on[want_buzz[j]] ) {
+      printf("FAIL buzzer silent in state %d\n", want_buzz[j]);
+      fail = 1;
+    }
+  return fail;
+}
+
+static void Report(void) {
+  int i, j;
+
+  Account();
+  printf("simulated %.3f s\n", Now());
+  for( i=0; i<STATES; ++i ) {
+    if( !in_state[i] ) continue;
+    printf("  state %3d  %.3f s, awake %.6f s (%llu cycles), buzzer %.3f s\n",
+           i, in_state[i], awake[i], (unsigned long long)cycles[i],
+           buzz_on[i]);
+    printf("  led on    ");
+    for( j=0; j<6; ++j ) printf(" %d: %.3f s", j, led_on[i][j]);
+    printf("\n");
+  }
+  printf("  sessions  ");
+  for( i=0; i<visits; ++i ) printf(" %d: %.3f s", visit[i], Visit_sec(i));
+  printf("\n");
+}
+
+//################################################################# Benchmark
+
+// A function of the firmware called with arguments in registers (avr-gcc's
+// ABI: the first in r24/r25, the next in r22/r23) with
+// the pad charging in `pad` cycles. `calls` calls in a row, the worst counts.
+// With `ocr1a`, the cycles up to the first write of OCR1A count instead.
+static const struct Bench {
+  const char *name, *func;
+  uint8_t reg[4][2];
+  unsigned pad, calls, ocr1a;
+} benches[] = {
+  { "Set_leds(-1)",        "Set_leds",   {{24,0xff},{25,0xff}},      0, 1, 0 },
+  { "Set_leds(0)",         "Set_leds",   {{24,0},{25,0}},            0, 1, 0 },
+  { "Set_leds(1)",         "Set_leds",   {{24,1},{25,0}},            0, 1, 0 },
+  { "Set_leds(2)",         "Set_leds",   {{24,2},{25,0}},            0, 1, 0 },
+  { "Set_leds(3)",         "Set_leds",   {{24,3},{25,0}},            0, 1, 0 },
+  { "Set_leds(4)",         "Set_leds",   {{24,4},{25,0}},            0, 1, 0 },
+  { "Set_leds(5)",         "Set_leds",   {{24,5},{25,0}},            0, 1, 0 },
+  { "TIMER1_COMPA_vect",   "__vector_3", {{0}},                      0, 2, 0 },
+  { "TIMER1_COMPA->OCR1A", "__vector_3", {{0}},                      0, 2, 1 },
+  { "WDT_vect",            "__vector_12", {{0}},                     0, 1, 0 },
+  { "Shine_led(0,1)",      "Shine_led",  {{24,0},{25,0},{22,1},{23,0}},
+                                                                 0, 1, 0 },
+  { "Get_time@20",         "Get_time",   {{0}},                     20, 1, 0 },
+  { "Get_time@60",         "Get_time",   {{0}},                     60, 1, 0 },
+  { "Get_time@200",        "Get_time",   {{0}},                    200, 1, 0 },
+  { "Sleep_now(1,15ms)",   "Sleep_now",  {{24,1},{22,0}},            0, 1, 0 },
+  { "Run_events",          "Run_events", {{0}},                      0, 1, 0 },
+  { "Led_update",          "Led_update", {{0}},                      0, 1, 0 },
+};
+
+// Call a function the way `call` does, with a return address of 0, and run
+// it to its ret. Cycles spent sleeping do not count.
+static uint64_t Call(uint16_t addr, const uint8_t reg[4][2]) {
+  uint16_t sp = avr->data[SP_ADDR] | avr->data[SP_ADDR+1] << 8;
+  uint64_t awake = 0, c;
+  int i, running, st;
+  double until = Now()+1;
+
+  avr->data[sp] = avr->data[sp-1] = 0;
+  sp -= 2;
+  avr->data[SP_ADDR] = sp;
+  avr->data[SP_ADDR+1] = sp >> 8;
+  for( i=0; i<4 && reg[i][0]; ++i ) avr->data[reg[i][0]] = reg[i][1];
+  avr->sreg[S_I] = 0;           // no interrupts but those the function allows
+  avr->pc = addr;
+  call_at = avr->cycle;
+  ocr1a_in = 0;
+  while( avr->pc && Now()<until ) {
+    c = avr->cycle;
+    running = avr->state==cpu_Running;
+    st = avr_run(avr);
+    if( st==cpu_Done || st==cpu_Crashed ) return UINT64_MAX;
+    if( running ) awake += avr->cycle-c;
+  }
+  return avr->pc ? UINT64_MAX : awake;
+}
+
+static int Boot(void);
+static int Run(double sec);
+
+// Rewrite the budget file with the cycles measured plus the headroom
+static int Record(const uint64_t *got) {
+  char line[256], name[128], tmp[512];
+  unsigned long b;
+  unsigned i, n = sizeof benches/sizeof *benches;
+  FILE *f, *o;
+
+  snprintf(tmp, sizeof tmp, "%s.new", budget_file);
+  if( !(f = fopen(budget_file, "r")) ) { perror(budget_file); return 1; }
+  if( !(o = fopen(tmp, "w")) ) { perror(tmp); fclose(f); return 1; }
+  while( fgets(line, sizeof line, f) ) {
+    if( sscanf(line, "%127s %lu", name, &b)==2 && name[0]!='#' )
+      for( i=0; i<n; ++i )
+        if( !strcmp(name, benches[i].name) ) {
+          snprintf(line, sizeof line, "%-19s%5llu\n", name,
+                   (unsigned long long)(got[i]*(100+headroom)+99)/100);
+          break;
+        }
+    fputs(line, o);
+  }
+  fclose(f);
+  if( fclose(o) || rename(tmp, budget_file) ) { perror(tmp); return 1; }
+  printf("# recorded with %d%% headroom in %s\n", headroom, budget_file);
+  return 0;
+}
+
+// Run every benchmark on the firmware as it is `sec` into the simulation,
+// compare with the budgets in the file (lines of name and cycles, # comments)
+static int Bench(double sec) {
+  unsigned pad = pad_base;
+  char line[256], name[128];
+  unsigned long budget[MAX_BENCH] = { 0 }, b;
+  unsigned i, j, n = sizeof benches/sizeof *benches;
+  uint64_t worst, c, got[MAX_BENCH];
+  uint16_t addr;
+  int fail = 0;
+  FILE *f;
+
+  if( !(f = fopen(budget_file, "r")) ) { perror(budget_file); return 1; }
+  while( fgets(line, sizeof line, f) )
+    if( sscanf(line, "%127s %lu", name, &b)==2 && name[0]!='#' )
+      for( i=0; i<n; ++i ) if( !strcmp(name, benches[i].name) ) budget[i] = b;
+  fclose(f);
+
+  quiet = 1;
+  printf("%-20s %8s %8s\n", "# benchmark", "cycles", "budget");
+  for( i=0; i<n; ++i ) {
+    if( !(addr = Symbol(benches[i].func)) ) {
+      printf("FAIL no function %s\n", benches[i].func);
+      fail = 1;
+      continue;
+    }
+    pad_base = pad;             // the same simulation up to the snapshot
+    if( !Boot() || Run(sec) ) {
+      printf("FAIL firmware does not get to %.6f s again\n", sec);
+      return 1;
+    }
+    pad_base = benches[i].pad ? benches[i].pad : pad;
+    for( worst=0, j=0; j<benches[i].calls; ++j ) {
+      if( (c = Call(addr, benches[i].reg))!=UINT64_MAX && benches[i].ocr1a )
+        c = ocr1a_in ? ocr1a_in : UINT64_MAX;
+      if( c>worst ) worst = c;
+    }
+    if( worst==UINT64_MAX )
+      printf("FAIL %s does not return\n", benches[i].name);
+    else printf("%-20s %8llu %8lu%s\n", benches[i].name,
+                (unsigned long long)worst, budget[i],
+                headroom<0 && budget[i] && worst>budget[i] ?
+                "  FAIL over budget" : "");
+    got[i] = worst;
+    if( worst==UINT64_MAX ) fail = 1;
+    else if( headroom<0 && budget[i] && worst>budget[i] ) fail = 1;
+  }
+  if( headroom>=0 ) return fail || Record(got);
+  return fail;
+}
+
+//######################################################################## Main
+
+static int Parse_pair(const char *arg, int *s, double *v) {
+  char *end;
+  *s = strtol(arg, &end, 0);
+  if( *end!=':' ) return 0;
+  *v = strtod(end+1, NULL);
+  return 1;
+}
+
+// A fresh core with the firmware loaded and the harness hooked in, at 0 s
+static int Boot(void) {
+  if( avr ) avr_terminate(avr);
+  sec_at = 0;
+  cyc_at = clkpce_at = 0;
+  clk_shift = charging = 0;
+  state = lit = -1;
+  pb0_at = -1;
+  if( !(avr = avr_make_mcu_by_name(fw.mmcu)) ) return 0;
+  avr_init(avr);
+  avr_load_firmware(avr, &fw);
+  avr->sleep = Sleep_none;
+  avr_register_io_write(avr, CLKPR_ADDR, Clkpr, NULL);
+  avr_register_io_write(avr, OCR1A_ADDR, Ocr1a, NULL);
+  pad_irq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 2);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'),
+                          IOPORT_IRQ_REG_PORT), Pins, NULL);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'),
+                          IOPORT_IRQ_DIRECTION_ALL), Pins, NULL);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 0),
+                          Buzzer, NULL);
+  State_changed(avr->data[state_addr]);
+  return 1;
+}
+
+// Simulate up to `sec`, 0 or how the firmware stopped
+static int Run(double sec) {
+  int st;
+
+  while( Now()<sec ) {
+    avr_cycle_count_t c = avr->cycle;
+    double t = Now();
+    int running = avr->state==cpu_Running;
+
+    st = avr_run(avr);
+    if( st==cpu_Done || st==cpu_Crashed ) return st;
+    if( running ) {
+      cycles[state] += avr->cycle-c;
+      awake[state] += Now()-t;
+    }
+    if( avr->data[state_addr]!=state ) State_changed(avr->data[state_addr]);
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int opt, st, s, fail;
+  double sec = 3600, v;
+  char *len, *p;
+
+  while( (opt = getopt(argc, argv, "f:t:b:d:v:qs:l:p:z:B:R:"))!=-1 ) {
+    switch( opt ) {
+      case 'f': elf_file = optarg;                    break;
+      case 't': sec = atof(optarg);                   break;
+      case 'b': pad_base = atoi(optarg);              break;
+      case 'd': pad_touch = atoi(optarg);             break;
+      case 'v': vcc = atof(optarg);                   break;
+      case 'q': quiet = 1;                            break;
+      case 'B': budget_file = optarg;                 break;
+      case 'R': headroom = atoi(optarg);              break;
+      case 's':
+        for( want_seqs=0, p=optarg; *p && want_seqs<MAX_VISIT; ++want_seqs ) {
+          want_seq[want_seqs] = strtol(p, &p, 0);
+          if( *p==',' ) ++p;
+        }
+        break;
+      case 'l':
+        if( want_lens<MAX_CHECK && Parse_pair(optarg, &s, &v) ) {
+          want_len[want_lens] = s;
+          want_sec[want_lens++] = v;
+          break;
+        }
+        goto usage;
+      case 'p':
+        if( want_leds<MAX_CHECK && Parse_pair(optarg, &s, &v) ) {
+          want_led[want_leds] = s;
+          want_mask[want_leds++] = strtol(strchr(optarg, ':')+1, NULL, 0);
+          break;
+        }
+        goto usage;
+      case 'z':
+        if( want_buzzes<MAX_CHECK ) want_buzz[want_buzzes++] = atoi(optarg);
+        break;
+      default:
+      usage:
+        fprintf(stderr, "usage: %s [-f elf] [-t sec] [-b cyc] [-d cyc] [-v V] "
+                "[-q] [-s state,...] [-l state:sec] [-p state:leds] "
+                "[-z state] [-B budgets [-R pct]] [touch[:length]] ...\n",
+                argv[0]);
+        return 2;
+    }
+  }
+  for( ; optind<argc && touches<MAX_TOUCH; ++optind, ++touches ) {
+    touch_at[touches] = strtod(argv[optind], &len);
+    touch_len[touches] = *len==':' ? atof(len+1) : 0.3;
+  }
+
+  if( elf_read_firmware(elf_file, &fw) ) {
+    fprintf(stderr, "cannot read %s\n", elf_file);
+    return 2;
+  }
+  if( !(state_addr = Symbol("state")) ) {
+    fprintf(stderr, "no symbol `state` in %s (is avr-nm installed?)\n",
+            elf_file);
+    return 2;
+  }
+  strcpy(fw.mmcu, MMCU);
+  fw.frequency = F_CPU;
+  fw.vcc = fw.avcc = vcc*1000;
+  if( !Boot() ) return 2;
+  if( (st = Run(sec)) ) {
+    printf("FAIL firmware %s at %.6f s\n", st==cpu_Done ? "stopped" :
+           "crashed", Now());
+    Report();
+    return 1;
+  }
+  Report();
+  fail = Check();               // before the benches simulate all over again
+  if( budget_file ) fail |= Bench(sec);
+  return fail;
+}
@@ -0,0 +1,91 @@
+/* Indent: space, Tabsize: 4, Encoding: UTF-8, Language: C/Eng, Breaks: linux */
+/**
+ * \file telemetry.c
+ *
+ * Decoder of the telemetry of a firmware built with TELEMETRY.
+ *
+ * Reads the byte stream that Tlm_send() clocks out on PB0 (38400 baud, 8N1,
+ * inverted levels), from a USB serial adapter on the MOSI line of the ISP
+ * header or from the mock's -u file, and writes one CSV line per record to
+ * stdout:
+ *
+ *     record,a,b,result
+ *     cal,<threshold>,<variance of the charge time>,
+ *     state,<state entered>,<uptime in ticks>,
+ *     sample,<charge time>,<baseline>,<quiet|press|near>
+ *
+ * Records are TLM_LEN bytes with a checksum. A byte that does not start a
+ * valid record is skipped, so the decoder finds its way into a stream that is
+ * already running. stty cannot invert the line: set the adapter's RX to
+ * inverted (FT_PROG for FTDI chips, the configuration tool for CP210x) or put
+ * an inverter in front of it. For example:
+ *
+ *     stty -F /dev/ttyUSB0 38400 raw && ./To-mate-Oh-telemetry </dev/ttyUSB0
+ *     ./To-mate-Oh-host -u tlm.bin 10 && ./To-mate-Oh-telemetry tlm.bin
+ *
+ * \date 17 Oct 2026
+ * \author <a href="mailto:con-f-use@gmx.net">con-f-use</a>
+ * \copyright
+ * This file is part of To-mate-Oh. Copyright © 2026 con-f-use. Use permitted
+ * under GNU General Public License v3.0.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+// The record format of To-mate-Oh.h
+#define TLM_SAMPLE 0x10
+#define TLM_CAL    0x20
+#define TLM_STATE  0x30
+#define TLM_LEN    6
+
+static int Valid(const uint8_t *r) {
+  uint8_t i, c = 0x5a;
+
+  if( (r[0] & 0xf0)!=TLM_CAL && (r[0] & 0xf0)!=TLM_STATE &&
+      ((r[0] & 0xf0)!=TLM_SAMPLE || (r[0] & 0x0f)>2) ) return 0;
+  for( i=0; i<TLM_LEN-1; ++i ) c -= r[i];
+  return c==r[TLM_LEN-1];
+}
+
+static void Print(const uint8_t *r) {
+  static const char *result[3] = { "quiet", "press", "near" };
+  unsigned a = r[1] << 8 | r[2], b = r[3] << 8 | r[4];
+
+  switch( r[0] & 0xf0 ) {
+    case TLM_SAMPLE:
+      printf("sample,%u,%.2f,%s\n", a, b/256.0, result[r[0] & 0x0f]); break;
+    case TLM_CAL:
+      printf("cal,%u,%.2f,\n", a, b/256.0);                           break;
+    case TLM_STATE:
+      printf("state,%u,%u,\n", a, b);                                 break;
+  }
+}
+
+int main(int argc, char **argv) {
+  FILE *f = stdin;
+  uint8_t r[TLM_LEN];
+  int n = 0, c, i;
+  unsigned long skipped = 0;
+
+  if( argc>1 && !(f = fopen(argv[1], "rb")) ) {
+    perror(argv[1]);
+    return 2;
+  }
+  printf("record,a,b,result\n");
+  while( (c = getc(f))!=EOF ) {
+    r[n++] = c;
+    if( n<TLM_LEN ) continue;
+    if( Valid(r) ) {
+      Print(r);
+      fflush(stdout);
+      n = 0;
+    } else {                    // out of step, try one byte later
+      for( i=1; i<TLM_LEN; ++i ) r[i-1] = r[i];
+      --n;
+      ++skipped;
+    }
+  }
+  if( skipped ) fprintf(stderr, "%lu bytes skipped\n", skipped);
+  return 0;
+}